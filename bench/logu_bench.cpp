@@ -0,0 +1,248 @@
+﻿#include "logu/logu.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Benchmarks of the logu hot paths.
+//
+// Usage: logu_bench [-n CALLS] [-t THREADS] [FILTER]
+//   -n CALLS    Calls per thread for each benchmark (default 200000)
+//   -t THREADS  Comma separated thread counts (default 1,2,4,N where N is the number of hardware threads)
+//   FILTER      Run only the benchmarks whose name contains FILTER
+//
+// Calls are timed in batches, so the latency percentiles are per call averaged over a batch.
+
+namespace {
+
+constexpr size_t batch_size = 32;
+constexpr auto bench_tag = "bench";
+const char* const bench_filename = "logu_bench.log";
+
+// Keeps results alive so that the compiler cannot drop the measured code
+std::atomic<size_t> g_sink { 0 };
+
+struct result {
+    std::vector<double> batch_ns; // Per call
+    double seconds = 0;
+    size_t calls = 0;
+};
+
+struct benchmark {
+    const char* name;
+    std::function<void()> setup;
+    std::function<size_t(size_t)> call; // Performs one call, returns something derived from its result
+};
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * static_cast<double>(sorted.size())));
+    return sorted[index];
+}
+
+result run(const benchmark& bench, size_t thread_count, size_t calls)
+{
+    using clock = std::chrono::steady_clock;
+    const size_t batches = std::max<size_t>(1, calls / batch_size);
+    std::vector<std::vector<double>> thread_batch_ns(thread_count);
+    std::atomic<size_t> ready(0);
+    std::atomic<bool> go(false);
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            auto& batch_ns = thread_batch_ns[t];
+            batch_ns.reserve(batches);
+            size_t sink = 0;
+            ++ready;
+            while (!go) {
+                std::this_thread::yield();
+            }
+            for (size_t b = 0; b < batches; ++b) {
+                const auto start = clock::now();
+                for (size_t i = 0; i < batch_size; ++i) {
+                    sink += bench.call(b * batch_size + i);
+                }
+                const auto end = clock::now();
+                batch_ns.push_back(std::chrono::duration<double, std::nano>(end - start).count() / batch_size);
+            }
+            g_sink += sink;
+        });
+    }
+    while (ready != thread_count) {
+        std::this_thread::yield();
+    }
+    const auto start = clock::now();
+    go = true;
+    for (auto& th : threads) {
+        th.join();
+    }
+    LOGU_LOGGER(bench_tag).flush();
+    const auto end = clock::now();
+
+    result r;
+    for (auto& batch_ns : thread_batch_ns) {
+        r.batch_ns.insert(r.batch_ns.end(), batch_ns.begin(), batch_ns.end());
+    }
+    std::sort(r.batch_ns.begin(), r.batch_ns.end());
+    r.seconds = std::chrono::duration<double>(end - start).count();
+    r.calls = batches * batch_size * thread_count;
+    return r;
+}
+
+void null_handler(const logu::record&, const char* str)
+{
+    g_sink.fetch_add(static_cast<size_t>(str[0]), std::memory_order_relaxed);
+}
+
+// Logger used by the end-to-end benchmarks, with the usual default output
+void set_logger(logu::severity severity)
+{
+    LOGU_LOGGER(bench_tag)
+        .set_severity(severity)
+        .set_formatter(logu::formatter());
+}
+
+std::vector<benchmark> make_benchmarks()
+{
+    std::vector<benchmark> benchmarks;
+
+    benchmarks.push_back({ "skip_disabled_level",
+        []() {
+            set_logger(logu::severity::error);
+            LOGU_LOGGER(bench_tag).set_handler(null_handler);
+        },
+        [](size_t i) {
+            LOGU_DEBUG_(bench_tag) << "skipped " << i;
+            return i;
+        } });
+
+    benchmarks.push_back({ "record_construct",
+        nullptr,
+        [](size_t i) {
+            logu::record record(logu::severity::info, bench_tag, LOGU_FILE(), LOGU_FUNC(), __LINE__);
+            record << "record " << i << ' ' << 1.5;
+            return record.message_view().size();
+        } });
+
+    benchmarks.push_back({ "formatter_format",
+        nullptr,
+        [](size_t i) {
+            static thread_local logu::formatter formatter;
+            static thread_local logu::format_buffer buffer;
+            logu::record record(logu::severity::info, bench_tag, LOGU_FILE(), LOGU_FUNC(), __LINE__);
+            record << "formatted " << i;
+            buffer.clear();
+            formatter.format_to(record, buffer);
+            return buffer.size();
+        } });
+
+    benchmarks.push_back({ "LOGU_VARS",
+        nullptr,
+        [](size_t i) {
+            const int n = static_cast<int>(i);
+            const std::string str = "text";
+            const double d = 0.25;
+            return LOGU_VARS(n, str, d).size();
+        } });
+
+    benchmarks.push_back({ "record_format",
+        nullptr,
+        [](size_t i) {
+            logu::record record(logu::severity::info, bench_tag, LOGU_FILE(), LOGU_FUNC(), __LINE__);
+            record.format("%s=%d (%.3f) %08x", "value", static_cast<int>(i), 0.5, static_cast<unsigned>(i));
+            return record.message_view().size();
+        } });
+
+    benchmarks.push_back({ "end_to_end_null_handler",
+        []() {
+            set_logger(logu::severity::debug);
+            LOGU_LOGGER(bench_tag).set_handler(null_handler);
+        },
+        [](size_t i) {
+            LOGU_INFO_(bench_tag) << "request " << i << " done";
+            return i;
+        } });
+
+    benchmarks.push_back({ "end_to_end_file",
+        []() {
+            set_logger(logu::severity::debug);
+            LOGU_LOGGER(bench_tag).set_handler(std::make_shared<logu::file_sink>(bench_filename));
+        },
+        [](size_t i) {
+            LOGU_INFO_(bench_tag) << "request " << i << " done";
+            return i;
+        } });
+
+    return benchmarks;
+}
+
+std::vector<size_t> parse_thread_counts(const char* str)
+{
+    std::vector<size_t> counts;
+    while (str != nullptr && *str != '\0') {
+        char* end = nullptr;
+        const unsigned long n = std::strtoul(str, &end, 10);
+        if (n > 0) {
+            counts.push_back(n);
+        }
+        str = (*end == ',') ? end + 1 : nullptr;
+    }
+    return counts;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t calls = 200000;
+    std::vector<size_t> thread_counts;
+    const char* filter = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            calls = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            thread_counts = parse_thread_counts(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            std::fprintf(stderr, "Usage: %s [-n CALLS] [-t THREADS] [FILTER]\n", argv[0]);
+            return 2;
+        } else {
+            filter = argv[i];
+        }
+    }
+    if (thread_counts.empty()) {
+        thread_counts = { 1, 2, 4 };
+        const size_t hardware = std::thread::hardware_concurrency();
+        if (hardware > 4) {
+            thread_counts.push_back(hardware);
+        }
+    }
+
+    std::printf("%-24s %7s %10s %10s %10s %10s %14s\n", "benchmark", "threads", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "calls/s");
+    for (const auto& bench : make_benchmarks()) {
+        if (filter != nullptr && std::strstr(bench.name, filter) == nullptr) {
+            continue;
+        }
+        for (size_t thread_count : thread_counts) {
+            if (bench.setup) {
+                bench.setup();
+            }
+            const result r = run(bench, thread_count, calls);
+            std::printf("%-24s %7zu %10.1f %10.1f %10.1f %10.1f %14.0f\n", bench.name, thread_count,
+                percentile(r.batch_ns, 0.5), percentile(r.batch_ns, 0.9), percentile(r.batch_ns, 0.99), percentile(r.batch_ns, 0.999),
+                static_cast<double>(r.calls) / r.seconds);
+        }
+    }
+    LOGU_LOGGER(bench_tag).set_handler(null_handler);
+    std::remove(bench_filename);
+    return 0;
+}
@@ -5,53 +5,135 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <new>
 #include <sstream>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
 // Option definitions
 
 // LOGU_DISABLE_LOGGING                - Disable all macros
+// LOGU_COMPILE_MIN_SEVERITY           - Remove statements below the severity at compile time (e.g. LOGU_SEVERITY_WARN)
+// LOGU_COMPILE_MIN_SEVERITY_TAGS      - Raise the compile time severity per tag (e.g. {"net", logu::severity::error}, {"db", logu::severity::warn})
 // LOGU_ENABLE_PLATFORM_LOGGER_ANDROID - Enable output to logcat (Only for Android)
 // LOGU_ENABLE_PLATFORM_LOGGER_LINUX   - Enable output to syslog (Only for Linux)
 // LOGU_ENABLE_PLATFORM_LOGGER_WINDOWS - Enable output to debugger (Only for Windows)
+// LOGU_ENABLE_IO_URING               - Let async_file_sink write through io_uring (Only for Linux)
+
+// Severity values usable in preprocessor conditions
+
+#define LOGU_SEVERITY_DEBUG 0
+#define LOGU_SEVERITY_INFO  1
+#define LOGU_SEVERITY_WARN  2
+#define LOGU_SEVERITY_ERROR 3
+#define LOGU_SEVERITY_NONE  4
+
+#if !defined(LOGU_COMPILE_MIN_SEVERITY)
+#define LOGU_COMPILE_MIN_SEVERITY LOGU_SEVERITY_DEBUG
+#endif
 
 // Basic logging macros
 
-#define LOGU_DEBUG LOGU_INTERNAL_OUTPUT(logu::severity::debug, "")
-#define LOGU_INFO  LOGU_INTERNAL_OUTPUT(logu::severity::info, "")
-#define LOGU_WARN  LOGU_INTERNAL_OUTPUT(logu::severity::warn, "")
-#define LOGU_ERROR LOGU_INTERNAL_OUTPUT(logu::severity::error, "")
+#define LOGU_DEBUG LOGU_INTERNAL_DEBUG(LOGU_INTERNAL_OUTPUT, "")
+#define LOGU_INFO  LOGU_INTERNAL_INFO(LOGU_INTERNAL_OUTPUT, "")
+#define LOGU_WARN  LOGU_INTERNAL_WARN(LOGU_INTERNAL_OUTPUT, "")
+#define LOGU_ERROR LOGU_INTERNAL_ERROR(LOGU_INTERNAL_OUTPUT, "")
 #define LOGU       LOGU_INTERNAL_OUTPUT(logu::severity::none, "")
 
-#define LOGU_DEBUG_(tagname) LOGU_INTERNAL_OUTPUT(logu::severity::debug, tagname)
-#define LOGU_INFO_(tagname)  LOGU_INTERNAL_OUTPUT(logu::severity::info, tagname)
-#define LOGU_WARN_(tagname)  LOGU_INTERNAL_OUTPUT(logu::severity::warn, tagname)
-#define LOGU_ERROR_(tagname) LOGU_INTERNAL_OUTPUT(logu::severity::error, tagname)
+#define LOGU_DEBUG_(tagname) LOGU_INTERNAL_DEBUG(LOGU_INTERNAL_OUTPUT, tagname)
+#define LOGU_INFO_(tagname)  LOGU_INTERNAL_INFO(LOGU_INTERNAL_OUTPUT, tagname)
+#define LOGU_WARN_(tagname)  LOGU_INTERNAL_WARN(LOGU_INTERNAL_OUTPUT, tagname)
+#define LOGU_ERROR_(tagname) LOGU_INTERNAL_ERROR(LOGU_INTERNAL_OUTPUT, tagname)
 #define LOGU_(tagname)       LOGU_INTERNAL_OUTPUT(logu::severity::none, tagname)
 
 // With condition
 
-#define LOGU_DEBUG_IF(condition) LOGU_INTERNAL_OUTPUT_IF(logu::severity::debug, "", condition)
-#define LOGU_INFO_IF(condition)  LOGU_INTERNAL_OUTPUT_IF(logu::severity::info, "", condition)
-#define LOGU_WARN_IF(condition)  LOGU_INTERNAL_OUTPUT_IF(logu::severity::warn, "", condition)
-#define LOGU_ERROR_IF(condition) LOGU_INTERNAL_OUTPUT_IF(logu::severity::error, "", condition)
+#define LOGU_DEBUG_IF(condition) LOGU_INTERNAL_DEBUG(LOGU_INTERNAL_OUTPUT_IF, "", condition)
+#define LOGU_INFO_IF(condition)  LOGU_INTERNAL_INFO(LOGU_INTERNAL_OUTPUT_IF, "", condition)
+#define LOGU_WARN_IF(condition)  LOGU_INTERNAL_WARN(LOGU_INTERNAL_OUTPUT_IF, "", condition)
+#define LOGU_ERROR_IF(condition) LOGU_INTERNAL_ERROR(LOGU_INTERNAL_OUTPUT_IF, "", condition)
 #define LOGU_IF(condition)       LOGU_INTERNAL_OUTPUT_IF(logu::severity::none, "", condition)
 
-#define LOGU_DEBUG_IF_(tagname, condition) LOGU_INTERNAL_OUTPUT_IF(logu::severity::debug, tagname, condition)
-#define LOGU_INFO_IF_(tagname, condition)  LOGU_INTERNAL_OUTPUT_IF(logu::severity::info, tagname, condition)
-#define LOGU_WARN_IF_(tagname, condition)  LOGU_INTERNAL_OUTPUT_IF(logu::severity::warn, tagname, condition)
-#define LOGU_ERROR_IF_(tagname, condition) LOGU_INTERNAL_OUTPUT_IF(logu::severity::error, tagname, condition)
+#define LOGU_DEBUG_IF_(tagname, condition) LOGU_INTERNAL_DEBUG(LOGU_INTERNAL_OUTPUT_IF, tagname, condition)
+#define LOGU_INFO_IF_(tagname, condition)  LOGU_INTERNAL_INFO(LOGU_INTERNAL_OUTPUT_IF, tagname, condition)
+#define LOGU_WARN_IF_(tagname, condition)  LOGU_INTERNAL_WARN(LOGU_INTERNAL_OUTPUT_IF, tagname, condition)
+#define LOGU_ERROR_IF_(tagname, condition) LOGU_INTERNAL_ERROR(LOGU_INTERNAL_OUTPUT_IF, tagname, condition)
 #define LOGU_IF_(tagname, condition)       LOGU_INTERNAL_OUTPUT_IF(logu::severity::none, tagname, condition)
 
+// Rate limited (the next output record tells how many were suppressed)
+
+// Every n-th time
+#define LOGU_DEBUG_EVERY_N(n) LOGU_INTERNAL_DEBUG(LOGU_INTERNAL_OUTPUT_EVERY_N, "", n)
+#define LOGU_INFO_EVERY_N(n)  LOGU_INTERNAL_INFO(LOGU_INTERNAL_OUTPUT_EVERY_N, "", n)
+#define LOGU_WARN_EVERY_N(n)  LOGU_INTERNAL_WARN(LOGU_INTERNAL_OUTPUT_EVERY_N, "", n)
+#define LOGU_ERROR_EVERY_N(n) LOGU_INTERNAL_ERROR(LOGU_INTERNAL_OUTPUT_EVERY_N, "", n)
+#define LOGU_EVERY_N(n)       LOGU_INTERNAL_OUTPUT_EVERY_N(logu::severity::none, "", n)
+
+#define LOGU_DEBUG_EVERY_N_(tagname, n) LOGU_INTERNAL_DEBUG(LOGU_INTERNAL_OUTPUT_EVERY_N, tagname, n)
+#define LOGU_INFO_EVERY_N_(tagname, n)  LOGU_INTERNAL_INFO(LOGU_INTERNAL_OUTPUT_EVERY_N, tagname, n)
+#define LOGU_WARN_EVERY_N_(tagname, n)  LOGU_INTERNAL_WARN(LOGU_INTERNAL_OUTPUT_EVERY_N, tagname, n)
+#define LOGU_ERROR_EVERY_N_(tagname, n) LOGU_INTERNAL_ERROR(LOGU_INTERNAL_OUTPUT_EVERY_N, tagname, n)
+#define LOGU_EVERY_N_(tagname, n)       LOGU_INTERNAL_OUTPUT_EVERY_N(logu::severity::none, tagname, n)
+
+// Only the first n times
+#define LOGU_DEBUG_FIRST_N(n) LOGU_INTERNAL_DEBUG(LOGU_INTERNAL_OUTPUT_FIRST_N, "", n)
+#define LOGU_INFO_FIRST_N(n)  LOGU_INTERNAL_INFO(LOGU_INTERNAL_OUTPUT_FIRST_N, "", n)
+#define LOGU_WARN_FIRST_N(n)  LOGU_INTERNAL_WARN(LOGU_INTERNAL_OUTPUT_FIRST_N, "", n)
+#define LOGU_ERROR_FIRST_N(n) LOGU_INTERNAL_ERROR(LOGU_INTERNAL_OUTPUT_FIRST_N, "", n)
+#define LOGU_FIRST_N(n)       LOGU_INTERNAL_OUTPUT_FIRST_N(logu::severity::none, "", n)
+
+#define LOGU_DEBUG_FIRST_N_(tagname, n) LOGU_INTERNAL_DEBUG(LOGU_INTERNAL_OUTPUT_FIRST_N, tagname, n)
+#define LOGU_INFO_FIRST_N_(tagname, n)  LOGU_INTERNAL_INFO(LOGU_INTERNAL_OUTPUT_FIRST_N, tagname, n)
+#define LOGU_WARN_FIRST_N_(tagname, n)  LOGU_INTERNAL_WARN(LOGU_INTERNAL_OUTPUT_FIRST_N, tagname, n)
+#define LOGU_ERROR_FIRST_N_(tagname, n) LOGU_INTERNAL_ERROR(LOGU_INTERNAL_OUTPUT_FIRST_N, tagname, n)
+#define LOGU_FIRST_N_(tagname, n)       LOGU_INTERNAL_OUTPUT_FIRST_N(logu::severity::none, tagname, n)
+
+// At most once per interval in milliseconds
+#define LOGU_DEBUG_EVERY_MS(ms) LOGU_INTERNAL_DEBUG(LOGU_INTERNAL_OUTPUT_EVERY_MS, "", ms)
+#define LOGU_INFO_EVERY_MS(ms)  LOGU_INTERNAL_INFO(LOGU_INTERNAL_OUTPUT_EVERY_MS, "", ms)
+#define LOGU_WARN_EVERY_MS(ms)  LOGU_INTERNAL_WARN(LOGU_INTERNAL_OUTPUT_EVERY_MS, "", ms)
+#define LOGU_ERROR_EVERY_MS(ms) LOGU_INTERNAL_ERROR(LOGU_INTERNAL_OUTPUT_EVERY_MS, "", ms)
+#define LOGU_EVERY_MS(ms)       LOGU_INTERNAL_OUTPUT_EVERY_MS(logu::severity::none, "", ms)
+
+#define LOGU_DEBUG_EVERY_MS_(tagname, ms) LOGU_INTERNAL_DEBUG(LOGU_INTERNAL_OUTPUT_EVERY_MS, tagname, ms)
+#define LOGU_INFO_EVERY_MS_(tagname, ms)  LOGU_INTERNAL_INFO(LOGU_INTERNAL_OUTPUT_EVERY_MS, tagname, ms)
+#define LOGU_WARN_EVERY_MS_(tagname, ms)  LOGU_INTERNAL_WARN(LOGU_INTERNAL_OUTPUT_EVERY_MS, tagname, ms)
+#define LOGU_ERROR_EVERY_MS_(tagname, ms) LOGU_INTERNAL_ERROR(LOGU_INTERNAL_OUTPUT_EVERY_MS, tagname, ms)
+#define LOGU_EVERY_MS_(tagname, ms)       LOGU_INTERNAL_OUTPUT_EVERY_MS(logu::severity::none, tagname, ms)
+
+// Randomly with the probability p (0.0 - 1.0)
+#define LOGU_DEBUG_SAMPLED(p) LOGU_INTERNAL_DEBUG(LOGU_INTERNAL_OUTPUT_SAMPLED, "", p)
+#define LOGU_INFO_SAMPLED(p)  LOGU_INTERNAL_INFO(LOGU_INTERNAL_OUTPUT_SAMPLED, "", p)
+#define LOGU_WARN_SAMPLED(p)  LOGU_INTERNAL_WARN(LOGU_INTERNAL_OUTPUT_SAMPLED, "", p)
+#define LOGU_ERROR_SAMPLED(p) LOGU_INTERNAL_ERROR(LOGU_INTERNAL_OUTPUT_SAMPLED, "", p)
+#define LOGU_SAMPLED(p)       LOGU_INTERNAL_OUTPUT_SAMPLED(logu::severity::none, "", p)
+
+#define LOGU_DEBUG_SAMPLED_(tagname, p) LOGU_INTERNAL_DEBUG(LOGU_INTERNAL_OUTPUT_SAMPLED, tagname, p)
+#define LOGU_INFO_SAMPLED_(tagname, p)  LOGU_INTERNAL_INFO(LOGU_INTERNAL_OUTPUT_SAMPLED, tagname, p)
+#define LOGU_WARN_SAMPLED_(tagname, p)  LOGU_INTERNAL_WARN(LOGU_INTERNAL_OUTPUT_SAMPLED, tagname, p)
+#define LOGU_ERROR_SAMPLED_(tagname, p) LOGU_INTERNAL_ERROR(LOGU_INTERNAL_OUTPUT_SAMPLED, tagname, p)
+#define LOGU_SAMPLED_(tagname, p)       LOGU_INTERNAL_OUTPUT_SAMPLED(logu::severity::none, tagname, p)
+
 // Get logger instance
 #define LOGU_LOGGER(tagname)        logu::internal::logger_holder::get(tagname)
 #define LOGU_LOGGER_STATIC(tagname) logu::internal::static_logger_holder<LOGU_HASH(tagname)>::get(tagname)
@@ -79,35 +161,106 @@
 
 // clang-format off
 
+// Expand to output(severity, ...) unless the severity is removed at compile time
+
+#define LOGU_INTERNAL_EXPAND(x) x // For __VA_ARGS__ on MSVC
+
+#if LOGU_COMPILE_MIN_SEVERITY > LOGU_SEVERITY_DEBUG
+#define LOGU_INTERNAL_DEBUG(output, ...) LOGU_INTERNAL_STRIPPED
+#else
+#define LOGU_INTERNAL_DEBUG(output, ...) LOGU_INTERNAL_EXPAND(output(logu::severity::debug, __VA_ARGS__))
+#endif
+
+#if LOGU_COMPILE_MIN_SEVERITY > LOGU_SEVERITY_INFO
+#define LOGU_INTERNAL_INFO(output, ...) LOGU_INTERNAL_STRIPPED
+#else
+#define LOGU_INTERNAL_INFO(output, ...) LOGU_INTERNAL_EXPAND(output(logu::severity::info, __VA_ARGS__))
+#endif
+
+#if LOGU_COMPILE_MIN_SEVERITY > LOGU_SEVERITY_WARN
+#define LOGU_INTERNAL_WARN(output, ...) LOGU_INTERNAL_STRIPPED
+#else
+#define LOGU_INTERNAL_WARN(output, ...) LOGU_INTERNAL_EXPAND(output(logu::severity::warn, __VA_ARGS__))
+#endif
+
+#if LOGU_COMPILE_MIN_SEVERITY > LOGU_SEVERITY_ERROR
+#define LOGU_INTERNAL_ERROR(output, ...) LOGU_INTERNAL_STRIPPED
+#else
+#define LOGU_INTERNAL_ERROR(output, ...) LOGU_INTERNAL_EXPAND(output(logu::severity::error, __VA_ARGS__))
+#endif
+
+// Swallows the stream expression in a branch that is never taken, without referring to any logger
+#if defined(_MSC_VER)
+#define LOGU_INTERNAL_STRIPPED          \
+    __pragma(warning(push))             \
+    __pragma(warning(disable : 4127))   \
+    if (true) { }                       \
+    else __pragma(warning(pop)) logu::internal::null_record()
+#else // _MSC_VAR
+#define LOGU_INTERNAL_STRIPPED if (true) { } else logu::internal::null_record()
+#endif // _MSC_VAR
+
 #define LOGU_INTERNAL_OUTPUT_IF(severity, tagname, conditional) if (!(conditional)) {;} else LOGU_INTERNAL_OUTPUT(severity, tagname)
 
-#define LOGU_INTERNAL_OUTPUT(severity, tagname)    \
-    LOGU_INTERNAL_SHOULD_OUTPUT(severity, tagname) \
-        LOGU_LOGGER_STATIC(tagname) += logu::record(severity, tagname, LOGU_FILE(), LOGU_FUNC(), __LINE__)
+#define LOGU_INTERNAL_OUTPUT(severity, tagname)                        \
+    LOGU_INTERNAL_SHOULD_OUTPUT(severity, tagname, logu_internal_site) \
+        logu_internal_site->logger() += logu::record(*logu_internal_site)
+
+#define LOGU_INTERNAL_OUTPUT_EVERY_N(severity, tagname, n)  LOGU_INTERNAL_OUTPUT_LIMITED(severity, tagname, logu::internal::every_n_limiter, n)
+#define LOGU_INTERNAL_OUTPUT_FIRST_N(severity, tagname, n)  LOGU_INTERNAL_OUTPUT_LIMITED(severity, tagname, logu::internal::first_n_limiter, n)
+#define LOGU_INTERNAL_OUTPUT_EVERY_MS(severity, tagname, ms) LOGU_INTERNAL_OUTPUT_LIMITED(severity, tagname, logu::internal::every_ms_limiter, ms)
+#define LOGU_INTERNAL_OUTPUT_SAMPLED(severity, tagname, p)  LOGU_INTERNAL_OUTPUT_LIMITED(severity, tagname, logu::internal::sampling_limiter, p)
+
+// The limiter state lives in a static of the call site and is only touched when the severity is enabled
+#define LOGU_INTERNAL_OUTPUT_LIMITED(severity, tagname, limiter_type, arg)                                                          \
+    LOGU_INTERNAL_SHOULD_OUTPUT(severity, tagname, logu_internal_site)                                                              \
+        for (logu::internal::limit_result logu_internal_limit = []() -> limiter_type& { static limiter_type logu_internal_limiter; return logu_internal_limiter; }().allow(arg); \
+             logu_internal_limit.allowed; logu_internal_limit.allowed = false)                                                      \
+            logu_internal_site->logger() += logu::record(*logu_internal_site).set_suppressed(logu_internal_limit.suppressed)
+
+// Descriptor of the call site, created and registered on first use.
+// func must be evaluated outside the lambda, where it names the enclosing function.
+#define LOGU_INTERNAL_CALL_SITE(severity, tagname, func)                                                               \
+    [](const char* logu_internal_func) -> logu::call_site* {                                                           \
+        static logu::call_site logu_internal_call_site(severity, tagname, LOGU_FILE(), logu_internal_func, __LINE__,   \
+            LOGU_LOGGER_STATIC(tagname));                                                                              \
+        return &logu_internal_call_site; }(func)
 
 #if defined(LOGU_DISABLE_LOGGING)
 
 #if defined(_MSC_VER)
-#define LOGU_INTERNAL_SHOULD_OUTPUT(severity, tagname) \
+#define LOGU_INTERNAL_SHOULD_OUTPUT(severity, tagname, site_var) \
     __pragma(warning(push))                   \
     __pragma(warning(disable : 4127))         \
     if (true) { }                             \
-    else __pragma(warning(pop))
+    else __pragma(warning(pop)) for (logu::call_site* site_var = nullptr; site_var != nullptr; site_var = nullptr)
 #else // _MSC_VAR
-#define LOGU_INTERNAL_SHOULD_OUTPUT(severity, tagname) \
-    if (true) { } else
+#define LOGU_INTERNAL_SHOULD_OUTPUT(severity, tagname, site_var) \
+    if (true) { } else for (logu::call_site* site_var = nullptr; site_var != nullptr; site_var = nullptr)
 #endif // _MSC_VAR
 
 #else // LOGU_DISABLE_LOGGING
 
-#define LOGU_INTERNAL_SHOULD_OUTPUT(severity, tagname)         \
-    if (!LOGU_LOGGER_STATIC(tagname).should_output(severity)) { } else
+// Runs the following statement once if the call site accepts the severity
+#if defined(LOGU_COMPILE_MIN_SEVERITY_TAGS)
+// A removed statement never calls the lambda, so its call site and logger are never created nor emitted
+#define LOGU_INTERNAL_SHOULD_OUTPUT(severity, tagname, site_var)                                                                       \
+    for (logu::call_site* site_var = logu::internal::compile_select<logu::internal::compile_min_severity(tagname) <= (severity)>::get( \
+             [](const char* logu_internal_enclosing_func) -> logu::call_site* {                                                        \
+                 return LOGU_INTERNAL_CALL_SITE(severity, tagname, logu_internal_enclosing_func); }, LOGU_FUNC());                    \
+         site_var != nullptr && site_var->should_output(); site_var = nullptr)
+#else // LOGU_COMPILE_MIN_SEVERITY_TAGS
+#define LOGU_INTERNAL_SHOULD_OUTPUT(severity, tagname, site_var)                 \
+    for (logu::call_site* site_var = LOGU_INTERNAL_CALL_SITE(severity, tagname, LOGU_FUNC()); \
+         site_var != nullptr && site_var->should_output(); site_var = nullptr)
+#endif // LOGU_COMPILE_MIN_SEVERITY_TAGS
 
 #endif // LOGU_DISABLE_LOGGING
 
 // clang-format on
 
 #if defined(_WIN32)
+#include <io.h>
 #include <time.h>
 #endif
 
@@ -118,6 +271,7 @@
 #endif
 
 #if defined(__linux__)
+#include <pthread.h>
 #include <unistd.h>
 #if !defined(__BIONIC__)
 #include <sys/syscall.h>
@@ -127,16 +281,90 @@
 #endif
 #endif
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(LOGU_ENABLE_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup)
+#define LOGU_INTERNAL_IO_URING
+#endif
+#endif
+#endif
+
 namespace logu {
 
 enum severity {
-    debug,
-    info,
-    warn,
-    error,
-    none
+    debug = LOGU_SEVERITY_DEBUG,
+    info = LOGU_SEVERITY_INFO,
+    warn = LOGU_SEVERITY_WARN,
+    error = LOGU_SEVERITY_ERROR,
+    none = LOGU_SEVERITY_NONE
+};
+
+// Non-owning reference to a character sequence
+class string_view {
+public:
+    string_view() = default;
+    string_view(const char* data, size_t size)
+        : data_(data)
+        , size_(size)
+    {
+    }
+
+    string_view(const char* str)
+        : data_(str != nullptr ? str : "")
+        , size_(str != nullptr ? std::char_traits<char>::length(str) : 0)
+    {
+    }
+
+    string_view(const std::string& str)
+        : data_(str.data())
+        , size_(str.size())
+    {
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t length() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+    char operator[](size_t i) const { return data_[i]; }
+    std::string str() const { return std::string(data_, size_); }
+
+private:
+    const char* data_ = "";
+    size_t size_ = 0;
 };
 
+inline bool operator==(const logu::string_view& lhs, const logu::string_view& rhs)
+{
+    return lhs.size() == rhs.size() && std::char_traits<char>::compare(lhs.data(), rhs.data(), lhs.size()) == 0;
+}
+
+inline bool operator!=(const logu::string_view& lhs, const logu::string_view& rhs)
+{
+    return !(lhs == rhs);
+}
+
+inline std::ostream& operator<<(std::ostream& os, const logu::string_view& str)
+{
+    return os.write(str.data(), static_cast<std::streamsize>(str.size()));
+}
+
 namespace internal {
 
     constexpr char path_separator()
@@ -159,6 +387,57 @@ namespace internal {
         return *s ? 1 + strlen_static(s + 1) : 0;
     }
 
+    constexpr bool strequal_static(const char* s1, const char* s2)
+    {
+        return (*s1 == *s2) && ((*s1 == '\0') || strequal_static(s1 + 1, s2 + 1));
+    }
+
+    // Minimum severity kept by the compiler for each tag
+    struct compile_severity {
+        const char* tagname;
+        logu::severity min_severity;
+    };
+
+#if defined(LOGU_COMPILE_MIN_SEVERITY_TAGS)
+    constexpr compile_severity compile_severities[] = { LOGU_COMPILE_MIN_SEVERITY_TAGS };
+    constexpr size_t compile_severity_count = sizeof(compile_severities) / sizeof(compile_severities[0]);
+
+    constexpr logu::severity compile_min_severity(const char* tagname, size_t i = 0)
+    {
+        return (i == compile_severity_count)                        ? static_cast<logu::severity>(LOGU_COMPILE_MIN_SEVERITY) :
+            strequal_static(compile_severities[i].tagname, tagname) ? compile_severities[i].min_severity :
+                                                                      compile_min_severity(tagname, i + 1);
+    }
+#endif
+
+    // Calls make only for the statements kept by the compile time severity
+    template <bool Enabled>
+    struct compile_select {
+        template <typename Make>
+        static auto get(Make make, const char* func) -> decltype(make(func)) { return make(func); }
+    };
+
+    template <>
+    struct compile_select<false> {
+        template <typename Make>
+        static auto get(Make make, const char* func) -> decltype(make(func)) { return nullptr; }
+    };
+
+    // Accepts and discards everything written to a removed log statement
+    class null_record {
+    public:
+        template <typename T>
+        null_record& operator<<(const T&) { return *this; }
+
+        null_record& operator<<(std::ostream& (*)(std::ostream&)) { return *this; }
+
+        template <typename... Args>
+        null_record& format(const char*, const Args&...) { return *this; }
+
+        template <typename KeyType, typename ValueType>
+        null_record& kv(const KeyType&, const ValueType&) { return *this; }
+    };
+
     constexpr const char* basename(const char* s)
     {
         return (s != nullptr) ? strrchr_static(s, s + strlen_static(s) - 1, path_separator()) : nullptr;
@@ -175,6 +454,54 @@ namespace internal {
 #endif
     }
 
+    // Write value as zero-padded decimal of the given width and return the end of the written digits
+    inline char* format_digits(char* out, uint64_t value, size_t width)
+    {
+        for (size_t i = width; i > 0; --i) {
+            out[i - 1] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        }
+        return out + width;
+    }
+
+    constexpr size_t datetime_size = 19; // "YYYY-MM-DD HH:MM:SS"
+
+    // Write "YYYY-MM-DD HH:MM:SS" (or "MM-DD HH:MM:SS" without year) and return the end of the written text.
+    // The local time is converted only when the second differs from the previous call on the same thread.
+    inline char* format_datetime(char* out, time_t time, bool with_year)
+    {
+        struct cache {
+            time_t time;
+            bool valid;
+            char text[datetime_size];
+        };
+        static thread_local cache caches[2];
+        cache& c = caches[with_year ? 1 : 0];
+        if (!c.valid || c.time != time) {
+            struct tm localt = {};
+            localtime_s(&localt, &time);
+            char* p = c.text;
+            if (with_year) {
+                p = format_digits(p, static_cast<uint64_t>(localt.tm_year + 1900), 4);
+                *p++ = '-';
+            }
+            p = format_digits(p, static_cast<uint64_t>(localt.tm_mon + 1), 2);
+            *p++ = '-';
+            p = format_digits(p, static_cast<uint64_t>(localt.tm_mday), 2);
+            *p++ = ' ';
+            p = format_digits(p, static_cast<uint64_t>(localt.tm_hour), 2);
+            *p++ = ':';
+            p = format_digits(p, static_cast<uint64_t>(localt.tm_min), 2);
+            *p++ = ':';
+            format_digits(p, static_cast<uint64_t>(localt.tm_sec), 2);
+            c.time = time;
+            c.valid = true;
+        }
+        const size_t len = with_year ? datetime_size : datetime_size - 5;
+        std::char_traits<char>::copy(out, c.text, len);
+        return out + len;
+    }
+
     constexpr bool is_null_or_empty(const char* s)
     {
         return s == nullptr || *s == '\0';
@@ -183,7 +510,7 @@ namespace internal {
 #if defined(_WIN32)
     extern "C" __declspec(dllimport) unsigned long __stdcall GetCurrentThreadId();
 #endif
-    inline uint64_t get_threadid()
+    inline uint64_t query_threadid()
     {
 #if defined(_WIN32)
         return static_cast<uint64_t>(GetCurrentThreadId());
@@ -196,6 +523,67 @@ namespace internal {
 #endif
     }
 
+    constexpr size_t threadname_size = 16;
+
+    // Per-thread cache. Kept trivial so that thread_local access needs no initialization guard.
+    struct thread_info {
+        uint64_t id;
+        bool name_loaded;
+        char name[threadname_size];
+    };
+
+    inline thread_info& current_thread_info()
+    {
+        static thread_local thread_info info;
+        return info;
+    }
+
+    inline void reset_thread_info_after_fork()
+    {
+        // Only the forking thread exists in the child, so resetting its cache is enough
+        current_thread_info().id = 0;
+    }
+
+    inline uint64_t get_threadid()
+    {
+        thread_info& info = current_thread_info();
+        if (info.id == 0) {
+#if defined(__linux__)
+            static const bool fork_handler_registered = (pthread_atfork(nullptr, nullptr, reset_thread_info_after_fork) == 0);
+            (void)fork_handler_registered;
+#endif
+            info.id = query_threadid();
+        }
+        return info.id;
+    }
+
+    inline void set_threadname(const char* name)
+    {
+        thread_info& info = current_thread_info();
+        size_t len = 0;
+        while (name != nullptr && len < threadname_size - 1 && name[len] != '\0') {
+            info.name[len] = name[len];
+            ++len;
+        }
+        info.name[len] = '\0';
+        info.name_loaded = true;
+    }
+
+    // Return the name given by logu::set_thread_name, or the name of the OS thread read on first use
+    inline const char* get_threadname()
+    {
+        thread_info& info = current_thread_info();
+        if (!info.name_loaded) {
+#if defined(__linux__) && !defined(__BIONIC__)
+            char name[threadname_size] = {};
+            set_threadname((pthread_getname_np(pthread_self(), name, sizeof(name)) == 0) ? name : nullptr);
+#else
+            set_threadname(nullptr);
+#endif
+        }
+        return info.name;
+    }
+
     namespace murmur3 {
         constexpr uint32_t seed = 0;
 
@@ -224,6 +612,16 @@ namespace internal {
 
         constexpr uint32_t murmur3(char const* str, size_t len) { return murmur3c(murmur3b(str + ((len >> 2) * sizeof(uint32_t)), len & 3, murmur3a(str, len >> 2)), len); }
         constexpr uint32_t operator"" _murmur3(char const* str, size_t len) { return murmur3(str, len); }
+
+        // Same result as murmur3() without the recursion, for strings given at runtime
+        inline uint32_t murmur3_runtime(char const* str, size_t len)
+        {
+            uint32_t h = seed;
+            for (size_t i = 0; i < (len >> 2); ++i) {
+                h = murmur3a_0(to_uint32(str + (i * sizeof(uint32_t))), h);
+            }
+            return murmur3c(murmur3b(str + ((len >> 2) * sizeof(uint32_t)), len & 3, h), len);
+        }
     }
 
     class noncopyable {
@@ -235,6 +633,88 @@ namespace internal {
         noncopyable& operator=(const noncopyable&);
     };
 
+    // Result of a rate limiter for one event
+    struct limit_result {
+        bool allowed;
+        uint64_t suppressed; // Events suppressed since the last allowed one
+    };
+
+    // Counts the suppressed events for the rate limiting macros
+    class rate_limiter : logu::internal::noncopyable {
+    protected:
+        limit_result result(bool allowed)
+        {
+            if (!allowed) {
+                suppressed_.fetch_add(1, std::memory_order_relaxed);
+                return { false, 0 };
+            }
+            return { true, suppressed_.exchange(0, std::memory_order_relaxed) };
+        }
+
+    private:
+        std::atomic<uint64_t> suppressed_ { 0 };
+    };
+
+    class every_n_limiter : public rate_limiter {
+    public:
+        limit_result allow(uint64_t n)
+        {
+            const uint64_t count = count_.fetch_add(1, std::memory_order_relaxed);
+            return result(n <= 1 || (count % n) == 0);
+        }
+
+    private:
+        std::atomic<uint64_t> count_ { 0 };
+    };
+
+    class first_n_limiter : public rate_limiter {
+    public:
+        limit_result allow(uint64_t n)
+        {
+            // Stop counting once the limit is reached so that the counter never wraps around
+            if (count_.load(std::memory_order_relaxed) >= n) {
+                return result(false);
+            }
+            return result(count_.fetch_add(1, std::memory_order_relaxed) < n);
+        }
+
+    private:
+        std::atomic<uint64_t> count_ { 0 };
+    };
+
+    class every_ms_limiter : public rate_limiter {
+    public:
+        limit_result allow(int64_t interval_ms)
+        {
+            const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            int64_t last = last_ms_.load(std::memory_order_relaxed);
+            // Only the thread that moves the timestamp forward may output
+            const bool allowed = (last == never || now - last >= interval_ms) && last_ms_.compare_exchange_strong(last, now, std::memory_order_relaxed);
+            return result(allowed);
+        }
+
+    private:
+        static constexpr int64_t never = std::numeric_limits<int64_t>::min();
+        std::atomic<int64_t> last_ms_ { never };
+    };
+
+    class sampling_limiter : public rate_limiter {
+    public:
+        limit_result allow(double probability)
+        {
+            // xorshift64* per thread
+            static thread_local uint64_t state = 0;
+            if (state == 0) {
+                state = (logu::internal::get_threadid() * 0x9e3779b97f4a7c15ull) | 1;
+            }
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            const double value = static_cast<double>((state * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0);
+            return result(value < probability);
+        }
+    };
+
     template <typename ValueType>
     struct output_wrapper {
         static void output(std::ostream& os, const ValueType& x)
@@ -293,195 +773,3709 @@ namespace internal {
         return ss.str();
     }
 
-} // namespace internal
-
-class record {
-public:
-    record(logu::severity severity, const char* tagname, const char* file, const char* func, size_t line)
-        : severity_(severity)
-        , tagname_(tagname)
-        , file_(file)
-        , func_(func)
-        , line_(line)
-        , threadid_(logu::internal::get_threadid())
-        , time_(std::chrono::system_clock::now())
-    {
-    }
-
-    record() = delete;
+    // Bounded lock-free queue based on Dmitry Vyukov's MPMC algorithm
+    template <typename ValueType>
+    class bounded_queue : logu::internal::noncopyable {
+    public:
+        explicit bounded_queue(size_t capacity)
+        {
+            size_t size = 2;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            mask_ = size - 1;
+            cells_.reset(new cell[size]);
+            for (size_t i = 0; i < size; ++i) {
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
 
-    logu::severity severity() const { return severity_; };
-    const char* tagname() const { return tagname_; };
-    const char* file() const { return file_; };
-    const char* func() const { return func_; };
-    size_t line() const { return line_; };
-    uint64_t threadid() const { return threadid_; };
-    std::chrono::system_clock::time_point time() const { return time_; };
+        ~bounded_queue()
+        {
+            while (try_consume([](ValueType&) {})) { }
+        }
 
-    template <typename Type>
-    logu::record& operator<<(const Type& data)
-    {
-        logu::internal::output_wrapper<Type>::output(ss_, data);
-        return *this;
-    }
+        size_t capacity() const { return mask_ + 1; }
 
-    template <typename... Args>
-    logu::record& format(const char* fmt, Args... args)
-    {
-        char buf[1024];
-        snprintf(buf, sizeof(buf), fmt, args...);
-        ss_ << buf;
-        return *this;
-    }
+        // The value is moved from only when the push succeeds
+        bool try_push(ValueType&& value)
+        {
+            cell* c;
+            size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+            for (;;) {
+                c = &cells_[pos & mask_];
+                const size_t seq = c->sequence.load(std::memory_order_acquire);
+                const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+                if (diff == 0) {
+                    if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = enqueue_pos_.load(std::memory_order_relaxed);
+                }
+            }
+            new (&c->storage) ValueType(std::move(value));
+            c->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
 
-    std::string message() const
-    {
-        return ss_.str();
-    }
+        // Calls func with the oldest value, then destroys it
+        template <typename Func>
+        bool try_consume(Func&& func)
+        {
+            cell* c;
+            size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+            for (;;) {
+                c = &cells_[pos & mask_];
+                const size_t seq = c->sequence.load(std::memory_order_acquire);
+                const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+                if (diff == 0) {
+                    if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = dequeue_pos_.load(std::memory_order_relaxed);
+                }
+            }
+            ValueType* value = reinterpret_cast<ValueType*>(&c->storage);
+            func(*value);
+            value->~ValueType();
+            c->sequence.store(pos + mask_ + 1, std::memory_order_release);
+            return true;
+        }
 
-private:
-    const logu::severity severity_;
-    const char* const tagname_;
-    const char* const file_;
-    const char* const func_;
-    const size_t line_;
-    const uint64_t threadid_;
-    const std::chrono::system_clock::time_point time_;
-    std::ostringstream ss_;
-};
+        bool empty() const
+        {
+            const size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+            return cells_[pos & mask_].sequence.load(std::memory_order_acquire) != pos + 1;
+        }
 
-class formatter_base {
-public:
-    virtual ~formatter_base() = default;
-    virtual std::string format(const logu::record& record) = 0;
-};
+    private:
+        struct cell {
+            std::atomic<size_t> sequence;
+            typename std::aligned_storage<sizeof(ValueType), alignof(ValueType)>::type storage;
+        };
 
-class formatter : public logu::formatter_base {
-public:
-    enum class option {
-        datetime,
-        datetime_year,
-        datetime_microsecond,
-        severity,
-        threadid,
-        file,
-        func,
-        line,
-        tagname
+        // Keep producer and consumer positions on separate cache lines
+        std::unique_ptr<cell[]> cells_;
+        size_t mask_ = 0;
+        char pad0_[64];
+        std::atomic<size_t> enqueue_pos_ { 0 };
+        char pad1_[64 - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> dequeue_pos_ { 0 };
     };
 
-public:
-    virtual ~formatter() = default;
+    // Character buffer holding up to InlineSize bytes without heap allocation
+    template <size_t InlineSize>
+    class basic_buffer {
+    public:
+        basic_buffer() = default;
 
-    std::string format(const logu::record& record)
-    {
-        std::ostringstream stream;
-        if (options_.at(option::datetime)) {
-            datetime(record, stream);
-        }
-        if (options_.at(option::severity)) {
-            severity(record, stream);
-        }
-        if (options_.at(option::threadid)) {
-            threadid(record, stream);
-        }
-        if (options_.at(option::file)) {
-            file(record, stream);
-        }
-        if (options_.at(option::func)) {
-            func(record, stream);
+        basic_buffer(const basic_buffer& rhs)
+        {
+            append(rhs.data(), rhs.size());
         }
-        if (options_.at(option::tagname)) {
-            tagname(record, stream);
+
+        basic_buffer(basic_buffer&& rhs)
+        {
+            *this = std::move(rhs);
         }
-        stream << record.message();
-        return stream.str();
-    }
 
-    formatter& set_option(option option_, bool enable)
+        basic_buffer& operator=(const basic_buffer& rhs)
+        {
+            if (this != &rhs) {
+                clear();
+                append(rhs.data(), rhs.size());
+            }
+            return *this;
+        }
+
+        basic_buffer& operator=(basic_buffer&& rhs)
+        {
+            if (this != &rhs) {
+                if (rhs.heap_) {
+                    heap_ = std::move(rhs.heap_);
+                    capacity_ = rhs.capacity_;
+                    size_ = rhs.size_;
+                } else {
+                    clear();
+                    append(rhs.data(), rhs.size());
+                }
+                rhs.capacity_ = InlineSize;
+                rhs.size_ = 0;
+            }
+            return *this;
+        }
+
+        const char* data() const { return heap_ ? heap_.get() : inline_; }
+        char* data() { return heap_ ? heap_.get() : inline_; }
+        size_t size() const { return size_; }
+        size_t capacity() const { return capacity_; }
+        bool empty() const { return size_ == 0; }
+        void clear() { size_ = 0; }
+        logu::string_view view() const { return logu::string_view(data(), size_); }
+
+        void reserve(size_t capacity)
+        {
+            if (capacity_ < capacity) {
+                size_t new_capacity = capacity_ * 2;
+                if (new_capacity < capacity) {
+                    new_capacity = capacity;
+                }
+                std::unique_ptr<char[]> new_heap(new char[new_capacity]);
+                std::char_traits<char>::copy(new_heap.get(), data(), size_);
+                heap_ = std::move(new_heap);
+                capacity_ = new_capacity;
+            }
+        }
+
+        // Extend the size by n and return the pointer to the extended area
+        char* extend(size_t n)
+        {
+            reserve(size_ + n);
+            char* p = data() + size_;
+            size_ += n;
+            return p;
+        }
+
+        void resize(size_t size)
+        {
+            reserve(size);
+            size_ = size;
+        }
+
+        void append(const char* s, size_t n)
+        {
+            std::char_traits<char>::copy(extend(n), s, n);
+        }
+
+        void append(const char* s)
+        {
+            append(s, std::char_traits<char>::length(s));
+        }
+
+        void push_back(char c)
+        {
+            if (size_ == capacity_) {
+                reserve(size_ + 1);
+            }
+            data()[size_++] = c;
+        }
+
+    private:
+        std::unique_ptr<char[]> heap_;
+        size_t size_ = 0;
+        size_t capacity_ = InlineSize;
+        alignas(uint64_t) char inline_[InlineSize]; // Aligned so that a record can keep its location at the start
+    };
+
+    using message_buffer = basic_buffer<256>;
+
+    // Stream buffer appending characters to a basic_buffer
+    template <typename BufferType>
+    class buffer_streambuf : public std::streambuf {
+    public:
+        explicit buffer_streambuf(BufferType& buffer)
+            : buffer_(buffer)
+        {
+        }
+
+    protected:
+        int_type overflow(int_type ch) override
+        {
+            if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+                buffer_.push_back(traits_type::to_char_type(ch));
+            }
+            return traits_type::not_eof(ch);
+        }
+
+        std::streamsize xsputn(const char* s, std::streamsize n) override
+        {
+            buffer_.append(s, static_cast<size_t>(n));
+            return n;
+        }
+
+    private:
+        BufferType& buffer_;
+    };
+
+    template <typename BufferType>
+    class buffer_ostream : public std::ostream {
+    public:
+        explicit buffer_ostream(BufferType& buffer)
+            : std::ostream(nullptr)
+            , streambuf_(buffer)
+        {
+            rdbuf(&streambuf_);
+        }
+
+    private:
+        buffer_streambuf<BufferType> streambuf_;
+    };
+
+    // Write the decimal digits of value ending at end and return the pointer to the first digit
+    inline char* format_uint_backward(char* end, uint64_t value)
+    {
+        do {
+            *--end = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        return end;
+    }
+
+    template <typename BufferType, typename IntType>
+    inline void append_integer(BufferType& buffer, IntType value)
+    {
+        char buf[24];
+        char* const end = buf + sizeof(buf);
+        char* begin;
+        if (value < 0) {
+            begin = format_uint_backward(end, 0 - static_cast<uint64_t>(value));
+            *--begin = '-';
+        } else {
+            begin = format_uint_backward(end, static_cast<uint64_t>(value));
+        }
+        buffer.append(begin, static_cast<size_t>(end - begin));
+    }
+
+    // Replace the decimal point of LC_NUMERIC written by snprintf with '.' and return the new size
+    inline size_t normalize_decimal_point(char* buf, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i) {
+            const char c = buf[i];
+            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-' || c == '+') {
+                continue;
+            }
+            // The locale's decimal point, which may take several bytes
+            size_t end = i + 1;
+            while (end < size && !(buf[end] >= '0' && buf[end] <= '9')) {
+                ++end;
+            }
+            buf[i] = '.';
+            std::memmove(buf + i + 1, buf + end, size - end);
+            return size - (end - i - 1);
+        }
+        return size;
+    }
+
+    // Append the value to the buffer directly if the type does not need std::ostream
+    template <typename ValueType, typename Enable = void>
+    struct fast_output {
+        template <typename BufferType>
+        static bool output(BufferType&, const ValueType&) { return false; }
+    };
+
+    template <size_t N>
+    struct fast_output<char[N]> {
+        template <typename BufferType>
+        static bool output(BufferType& buffer, const char (&x)[N])
+        {
+            buffer.append(x);
+            return true;
+        }
+    };
+
+    template <typename CharType>
+    struct fast_output<CharType*, typename std::enable_if<std::is_same<typename std::remove_const<CharType>::type, char>::value>::type> {
+        template <typename BufferType>
+        static bool output(BufferType& buffer, const char* x)
+        {
+            buffer.append((x != nullptr) ? x : "(null)");
+            return true;
+        }
+    };
+
+    template <>
+    struct fast_output<std::string> {
+        template <typename BufferType>
+        static bool output(BufferType& buffer, const std::string& x)
+        {
+            buffer.append(x.data(), x.size());
+            return true;
+        }
+    };
+
+    template <>
+    struct fast_output<logu::string_view> {
+        template <typename BufferType>
+        static bool output(BufferType& buffer, const logu::string_view& x)
+        {
+            buffer.append(x.data(), x.size());
+            return true;
+        }
+    };
+
+    template <>
+    struct fast_output<char> {
+        template <typename BufferType>
+        static bool output(BufferType& buffer, char x)
+        {
+            buffer.push_back(x);
+            return true;
+        }
+    };
+
+    template <typename IntType>
+    struct fast_output<IntType, typename std::enable_if<std::is_integral<IntType>::value && !std::is_same<IntType, bool>::value && (sizeof(IntType) > 1)>::type> {
+        template <typename BufferType>
+        static bool output(BufferType& buffer, IntType x)
+        {
+            logu::internal::append_integer(buffer, x);
+            return true;
+        }
+    };
+
+    // Same as the default std::ostream format ("%g" with a precision of 6) in the classic locale
+    template <typename FloatType>
+    struct fast_output<FloatType, typename std::enable_if<std::is_floating_point<FloatType>::value>::type> {
+        template <typename BufferType>
+        static bool output(BufferType& buffer, FloatType x)
+        {
+            char buf[64];
+            const int len = std::is_same<FloatType, long double>::value
+                ? std::snprintf(buf, sizeof(buf), "%.6Lg", static_cast<long double>(x))
+                : std::snprintf(buf, sizeof(buf), "%.6g", static_cast<double>(x));
+            if (len < 0 || static_cast<size_t>(len) >= sizeof(buf)) {
+                return false;
+            }
+            buffer.append(buf, logu::internal::normalize_decimal_point(buf, static_cast<size_t>(len)));
+            return true;
+        }
+    };
+
+    // Argument of record::format with its type kept for checking against the conversion
+    struct format_arg {
+        enum class type {
+            none,
+            signed_integer,
+            unsigned_integer,
+            character,
+            boolean,
+            floating,
+            long_floating,
+            string,
+            pointer
+        };
+
+        type type_ = type::none;
+        const char* type_name = "";
+        size_t size = 0; // Size of the integer type
+        union {
+            long long i;
+            unsigned long long u;
+            double d;
+            const void* p;
+        };
+        long double ld = 0;
+        const char* str = nullptr;
+        size_t str_len = 0;
+
+        format_arg()
+            : u(0)
+        {
+        }
+    };
+
+    template <typename IntType>
+    inline format_arg make_integer_format_arg(IntType value, const char* type_name)
+    {
+        format_arg arg;
+        arg.type_name = type_name;
+        arg.size = sizeof(IntType);
+        if (std::is_signed<IntType>::value) {
+            arg.type_ = format_arg::type::signed_integer;
+            arg.i = static_cast<long long>(value);
+        } else {
+            arg.type_ = format_arg::type::unsigned_integer;
+            arg.u = static_cast<unsigned long long>(value);
+        }
+        return arg;
+    }
+
+    inline format_arg make_format_arg(signed char value) { return make_integer_format_arg(value, "signed char"); }
+    inline format_arg make_format_arg(unsigned char value) { return make_integer_format_arg(value, "unsigned char"); }
+    inline format_arg make_format_arg(short value) { return make_integer_format_arg(value, "short"); }
+    inline format_arg make_format_arg(unsigned short value) { return make_integer_format_arg(value, "unsigned short"); }
+    inline format_arg make_format_arg(int value) { return make_integer_format_arg(value, "int"); }
+    inline format_arg make_format_arg(unsigned int value) { return make_integer_format_arg(value, "unsigned int"); }
+    inline format_arg make_format_arg(long value) { return make_integer_format_arg(value, "long"); }
+    inline format_arg make_format_arg(unsigned long value) { return make_integer_format_arg(value, "unsigned long"); }
+    inline format_arg make_format_arg(long long value) { return make_integer_format_arg(value, "long long"); }
+    inline format_arg make_format_arg(unsigned long long value) { return make_integer_format_arg(value, "unsigned long long"); }
+
+    inline format_arg make_format_arg(char value)
+    {
+        format_arg arg = make_integer_format_arg(value, "char");
+        arg.type_ = format_arg::type::character;
+        return arg;
+    }
+
+    inline format_arg make_format_arg(bool value)
+    {
+        format_arg arg = make_integer_format_arg(static_cast<unsigned int>(value), "bool");
+        arg.type_ = format_arg::type::boolean;
+        return arg;
+    }
+
+    inline format_arg make_format_arg(float value)
+    {
+        format_arg arg;
+        arg.type_ = format_arg::type::floating;
+        arg.type_name = "float";
+        arg.d = value;
+        return arg;
+    }
+
+    inline format_arg make_format_arg(double value)
+    {
+        format_arg arg;
+        arg.type_ = format_arg::type::floating;
+        arg.type_name = "double";
+        arg.d = value;
+        return arg;
+    }
+
+    inline format_arg make_format_arg(long double value)
+    {
+        format_arg arg;
+        arg.type_ = format_arg::type::long_floating;
+        arg.type_name = "long double";
+        arg.ld = value;
+        return arg;
+    }
+
+    inline format_arg make_format_arg(const char* value)
+    {
+        format_arg arg;
+        arg.type_ = format_arg::type::string;
+        arg.type_name = "string";
+        arg.str = (value != nullptr) ? value : "(null)";
+        arg.str_len = std::char_traits<char>::length(arg.str);
+        return arg;
+    }
+
+    inline format_arg make_format_arg(const std::string& value)
+    {
+        format_arg arg;
+        arg.type_ = format_arg::type::string;
+        arg.type_name = "string";
+        arg.str = value.data();
+        arg.str_len = value.size();
+        return arg;
+    }
+
+    inline format_arg make_format_arg(const logu::string_view& value)
+    {
+        format_arg arg;
+        arg.type_ = format_arg::type::string;
+        arg.type_name = "string";
+        arg.str = value.data();
+        arg.str_len = value.size();
+        return arg;
+    }
+
+    inline format_arg make_format_arg(const void* value)
+    {
+        format_arg arg;
+        arg.type_ = format_arg::type::pointer;
+        arg.type_name = "pointer";
+        arg.p = value;
+        return arg;
+    }
+
+    inline format_arg make_format_arg(std::nullptr_t)
+    {
+        return make_format_arg(static_cast<const void*>(nullptr));
+    }
+
+    // Only the types above can be formatted. Others fail to compile.
+    template <typename ValueType>
+    inline format_arg make_format_arg(const ValueType* value)
+    {
+        return make_format_arg(static_cast<const void*>(value));
+    }
+
+    template <typename EnumType>
+    inline typename std::enable_if<std::is_enum<EnumType>::value, format_arg>::type make_format_arg(EnumType value)
+    {
+        return make_format_arg(static_cast<typename std::underlying_type<EnumType>::type>(value));
+    }
+
+    // Append the result of snprintf without truncation
+    template <typename BufferType, typename ValueType>
+    inline void append_snprintf(BufferType& buffer, const char* spec, ValueType value)
+    {
+        const size_t size = buffer.size();
+        size_t avail = (buffer.capacity() - size < 64) ? 64 : buffer.capacity() - size;
+        for (;;) {
+            char* p = buffer.extend(avail);
+            const int n = snprintf(p, avail, spec, value);
+            if (n < 0) {
+                buffer.resize(size);
+                return;
+            }
+            if (static_cast<size_t>(n) < avail) {
+                buffer.resize(size + static_cast<size_t>(n));
+                return;
+            }
+            buffer.resize(size);
+            avail = static_cast<size_t>(n) + 1;
+        }
+    }
+
+    template <typename BufferType>
+    inline void append_padded(BufferType& buffer, const char* s, size_t len, size_t width, bool left)
+    {
+        if (!left) {
+            for (size_t i = len; i < width; ++i) {
+                buffer.push_back(' ');
+            }
+        }
+        buffer.append(s, len);
+        if (left) {
+            for (size_t i = len; i < width; ++i) {
+                buffer.push_back(' ');
+            }
+        }
+    }
+
+    // Width or precision taken from a '*' argument, or -1 if the argument is not an integer in the range of int
+    inline long long format_star_value(const format_arg& arg)
+    {
+        if (arg.type_ == format_arg::type::unsigned_integer) {
+            return (arg.u <= static_cast<uint64_t>(std::numeric_limits<int>::max())) ? static_cast<long long>(arg.u) : -1;
+        }
+        if (arg.type_ == format_arg::type::signed_integer && -static_cast<long long>(std::numeric_limits<int>::max()) <= arg.i && arg.i <= std::numeric_limits<int>::max()) {
+            return arg.i;
+        }
+        return std::numeric_limits<long long>::min();
+    }
+
+    // Digits of a width or precision, or -1 beyond the range of int
+    inline long long parse_format_number(const char*& p)
+    {
+        long long value = 0;
+        for (; '0' <= *p && *p <= '9'; ++p) {
+            if (value <= std::numeric_limits<int>::max()) {
+                value = value * 10 + (*p - '0');
+            }
+        }
+        return (value <= std::numeric_limits<int>::max()) ? value : -1;
+    }
+
+    template <typename BufferType>
+    inline void append_format_error(BufferType& buffer, char conversion, const char* detail)
+    {
+        buffer.append("%!", 2);
+        if (conversion != '\0') {
+            buffer.push_back(conversion);
+        }
+        buffer.push_back('(');
+        buffer.append(detail);
+        buffer.push_back(')');
+    }
+
+    // printf-compatible formatting checked against the argument types.
+    // A conversion that does not match its argument is written as "%!d(string)", a missing argument as
+    // "%!d(MISSING)" and an unused argument as "%!(EXTRA int)". Length modifiers are accepted and ignored
+    // since the argument types are known.
+    template <typename BufferType>
+    inline void format_printf(BufferType& buffer, const char* fmt, const format_arg* args, size_t arg_count)
+    {
+        using type = format_arg::type;
+        size_t arg_index = 0;
+        const char* p = (fmt != nullptr) ? fmt : "";
+        while (*p != '\0') {
+            const char* literal = p;
+            while (*p != '\0' && *p != '%') {
+                ++p;
+            }
+            buffer.append(literal, static_cast<size_t>(p - literal));
+            if (*p == '\0') {
+                break;
+            }
+            ++p;
+            if (*p == '%') {
+                buffer.push_back('%');
+                ++p;
+                continue;
+            }
+
+            // %[flags][width][.precision][length]conversion
+            char spec[40] = "%";
+            size_t spec_len = 1;
+            bool left = false;
+            while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+                left = left || *p == '-';
+                if (spec_len < 8) {
+                    spec[spec_len++] = *p;
+                }
+                ++p;
+            }
+            // Widths and precisions are limited to the range of int as in printf
+            long long width = -1;
+            long long precision = -1;
+            bool bad_star = false;
+            if (*p == '*') {
+                ++p;
+                width = (arg_index < arg_count) ? format_star_value(args[arg_index++]) : std::numeric_limits<long long>::min();
+                if (width == std::numeric_limits<long long>::min()) {
+                    bad_star = true;
+                } else if (width < 0) {
+                    left = true;
+                    spec[spec_len++] = '-';
+                    width = -width;
+                }
+            } else if ('0' <= *p && *p <= '9') {
+                width = parse_format_number(p);
+                bad_star = width < 0;
+            }
+            if (*p == '.') {
+                ++p;
+                if (*p == '*') {
+                    ++p;
+                    precision = (arg_index < arg_count) ? format_star_value(args[arg_index++]) : std::numeric_limits<long long>::min();
+                    bad_star = bad_star || precision == std::numeric_limits<long long>::min();
+                    precision = (precision < 0) ? -1 : precision;
+                } else {
+                    precision = parse_format_number(p);
+                    bad_star = bad_star || precision < 0;
+                }
+            }
+            while (*p == 'h' || *p == 'l' || *p == 'L' || *p == 'z' || *p == 'j' || *p == 't' || *p == 'q') {
+                ++p;
+            }
+            const char conversion = *p;
+            if (conversion == '\0') {
+                append_format_error(buffer, '\0', "NOVERB");
+                break;
+            }
+            ++p;
+            if (bad_star) {
+                append_format_error(buffer, conversion, "BADWIDTH");
+                continue;
+            }
+            if (arg_count <= arg_index) {
+                append_format_error(buffer, conversion, "MISSING");
+                continue;
+            }
+            const format_arg& arg = args[arg_index++];
+            const bool plain = spec_len == 1 && width < 0 && precision < 0;
+            // At most 9 flags, 10 digits of width, '.' and 10 digits of precision, then the length and conversion
+            if (0 <= width) {
+                spec_len += static_cast<size_t>(snprintf(spec + spec_len, sizeof(spec) - spec_len, "%lld", width));
+            }
+            if (0 <= precision) {
+                spec_len += static_cast<size_t>(snprintf(spec + spec_len, sizeof(spec) - spec_len, ".%lld", precision));
+            }
+            width = (width < 0) ? 0 : width;
+
+            const bool is_integer = arg.type_ == type::signed_integer || arg.type_ == type::unsigned_integer || arg.type_ == type::character || arg.type_ == type::boolean;
+            const bool is_floating = arg.type_ == type::floating || arg.type_ == type::long_floating;
+            switch (conversion) {
+            case 'd':
+            case 'i':
+                if (!is_integer) {
+                    append_format_error(buffer, conversion, arg.type_name);
+                } else if (plain) {
+                    if (arg.type_ == type::unsigned_integer) {
+                        append_integer(buffer, arg.u);
+                    } else {
+                        append_integer(buffer, arg.i);
+                    }
+                } else {
+                    std::char_traits<char>::copy(spec + spec_len, (arg.type_ == type::unsigned_integer) ? "llu" : "lld", 4);
+                    if (arg.type_ == type::unsigned_integer) {
+                        append_snprintf(buffer, spec, arg.u);
+                    } else {
+                        append_snprintf(buffer, spec, arg.i);
+                    }
+                }
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                if (!is_integer) {
+                    append_format_error(buffer, conversion, arg.type_name);
+                } else {
+                    // Same result as C for negative values: reinterpret in the width of the original type
+                    const unsigned long long value = (arg.size < sizeof(unsigned long long)) ? (arg.u & ((1ULL << (arg.size * 8)) - 1)) : arg.u;
+                    if (plain && conversion == 'u') {
+                        append_integer(buffer, value);
+                    } else {
+                        spec[spec_len] = 'l';
+                        spec[spec_len + 1] = 'l';
+                        spec[spec_len + 2] = conversion;
+                        spec[spec_len + 3] = '\0';
+                        append_snprintf(buffer, spec, value);
+                    }
+                }
+                break;
+            case 'c':
+                if (!is_integer) {
+                    append_format_error(buffer, conversion, arg.type_name);
+                } else {
+                    const char c = static_cast<char>(arg.i);
+                    append_padded(buffer, &c, 1, static_cast<size_t>(width), left);
+                }
+                break;
+            case 's':
+                if (arg.type_ == type::string) {
+                    const size_t len = (0 <= precision && static_cast<size_t>(precision) < arg.str_len) ? static_cast<size_t>(precision) : arg.str_len;
+                    append_padded(buffer, arg.str, len, static_cast<size_t>(width), left);
+                } else {
+                    append_format_error(buffer, conversion, arg.type_name);
+                }
+                break;
+            case 'p':
+                if (arg.type_ == type::pointer) {
+                    spec[spec_len] = 'p';
+                    spec[spec_len + 1] = '\0';
+                    append_snprintf(buffer, spec, arg.p);
+                } else {
+                    append_format_error(buffer, conversion, arg.type_name);
+                }
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                if (arg.type_ == type::long_floating) {
+                    spec[spec_len] = 'L';
+                    spec[spec_len + 1] = conversion;
+                    spec[spec_len + 2] = '\0';
+                    append_snprintf(buffer, spec, arg.ld);
+                } else if (is_floating || arg.type_ == type::signed_integer || arg.type_ == type::unsigned_integer) {
+                    // Integers are converted to double rather than reinterpreted
+                    const double value = is_floating ? arg.d : (arg.type_ == type::signed_integer) ? static_cast<double>(arg.i) : static_cast<double>(arg.u);
+                    spec[spec_len] = conversion;
+                    spec[spec_len + 1] = '\0';
+                    append_snprintf(buffer, spec, value);
+                } else {
+                    append_format_error(buffer, conversion, arg.type_name);
+                }
+                break;
+            default:
+                append_format_error(buffer, conversion, "BADVERB");
+                break;
+            }
+        }
+        for (; arg_index < arg_count; ++arg_index) {
+            buffer.append("%!(EXTRA ", 9);
+            buffer.append(args[arg_index].type_name);
+            buffer.push_back(')');
+        }
+    }
+
+} // namespace internal
+
+// Typed value attached to a record with record::kv()
+struct field {
+    enum class type {
+        signed_integer,
+        unsigned_integer,
+        floating,
+        boolean,
+        string
+    };
+
+    logu::string_view key;
+    type value_type = type::string;
+    int64_t i = 0;
+    uint64_t u = 0;
+    double d = 0;
+    bool b = false;
+    logu::string_view str;
+};
+
+namespace internal {
+    // Fields are stored one after another as [type:1][key length:4][key][value], where the value is
+    // 8 bytes for numbers, 1 byte for booleans and [length:4][characters] for strings
+    using field_buffer = logu::internal::basic_buffer<64>;
+
+    template <typename ValueType>
+    inline void append_raw(field_buffer& buffer, const ValueType& value)
+    {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename ValueType>
+    inline ValueType read_raw(const char*& p)
+    {
+        ValueType value;
+        std::memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+        return value;
+    }
+
+    inline void append_field_string(field_buffer& buffer, const char* str, size_t len)
+    {
+        append_raw(buffer, static_cast<uint32_t>(len));
+        buffer.append(str, len);
+    }
+
+    inline void append_field(field_buffer& buffer, logu::string_view key, const format_arg& arg)
+    {
+        logu::field::type value_type;
+        switch (arg.type_) {
+        case format_arg::type::signed_integer:
+            value_type = logu::field::type::signed_integer;
+            break;
+        case format_arg::type::unsigned_integer:
+        case format_arg::type::pointer:
+            value_type = logu::field::type::unsigned_integer;
+            break;
+        case format_arg::type::floating:
+        case format_arg::type::long_floating:
+            value_type = logu::field::type::floating;
+            break;
+        case format_arg::type::boolean:
+            value_type = logu::field::type::boolean;
+            break;
+        default:
+            value_type = logu::field::type::string;
+            break;
+        }
+        buffer.push_back(static_cast<char>(value_type));
+        append_field_string(buffer, key.data(), key.size());
+        switch (arg.type_) {
+        case format_arg::type::signed_integer:
+            append_raw(buffer, static_cast<int64_t>(arg.i));
+            break;
+        case format_arg::type::unsigned_integer:
+            append_raw(buffer, static_cast<uint64_t>(arg.u));
+            break;
+        case format_arg::type::pointer:
+            append_raw(buffer, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(arg.p)));
+            break;
+        case format_arg::type::floating:
+            append_raw(buffer, arg.d);
+            break;
+        case format_arg::type::long_floating:
+            append_raw(buffer, static_cast<double>(arg.ld));
+            break;
+        case format_arg::type::boolean:
+            buffer.push_back(arg.u != 0 ? '\1' : '\0');
+            break;
+        case format_arg::type::character: {
+            const char c = static_cast<char>(arg.i);
+            append_field_string(buffer, &c, 1);
+            break;
+        }
+        default:
+            append_field_string(buffer, arg.str, arg.str_len);
+            break;
+        }
+    }
+
+    template <typename Func>
+    inline void for_each_field(const field_buffer& buffer, size_t offset, Func func)
+    {
+        const char* p = buffer.data() + offset;
+        const char* const end = buffer.data() + buffer.size();
+        while (p < end) {
+            logu::field f;
+            f.value_type = static_cast<logu::field::type>(*p++);
+            const uint32_t key_len = read_raw<uint32_t>(p);
+            f.key = logu::string_view(p, key_len);
+            p += key_len;
+            switch (f.value_type) {
+            case logu::field::type::signed_integer:
+                f.i = read_raw<int64_t>(p);
+                break;
+            case logu::field::type::unsigned_integer:
+                f.u = read_raw<uint64_t>(p);
+                break;
+            case logu::field::type::floating:
+                f.d = read_raw<double>(p);
+                break;
+            case logu::field::type::boolean:
+                f.b = (*p++ != '\0');
+                break;
+            case logu::field::type::string: {
+                const uint32_t len = read_raw<uint32_t>(p);
+                f.str = logu::string_view(p, len);
+                p += len;
+                break;
+            }
+            }
+            func(f);
+        }
+    }
+} // namespace internal
+
+// Severity, tag and position of a logging statement
+class source_location {
+public:
+    source_location(logu::severity severity, const char* tagname, const char* file, const char* func, size_t line)
+        : severity_(severity)
+        , tagname_(tagname)
+        , file_(file)
+        , func_(func)
+        , line_(line)
+    {
+    }
+
+    logu::severity severity() const { return severity_; };
+    const char* tagname() const { return tagname_; };
+    const char* file() const { return file_; };
+    const char* func() const { return func_; };
+    size_t line() const { return line_; };
+
+private:
+    const logu::severity severity_;
+    const char* const tagname_;
+    const char* const file_;
+    const char* const func_;
+    const size_t line_;
+};
+
+class record {
+public:
+    // Refers to the location, which must live until the program ends (e.g. a logu::call_site)
+    // since sinks may identify the call site by its address
+    explicit record(const logu::source_location& location)
+        : location_(&location)
+        , threadid_(logu::internal::get_threadid())
+        , time_(std::chrono::system_clock::now())
+    {
+        std::char_traits<char>::copy(threadname_, logu::internal::get_threadname(), sizeof(threadname_));
+    }
+
+    record(logu::severity severity, const char* tagname, const char* file, const char* func, size_t line)
+        : location_(nullptr)
+        , threadid_(logu::internal::get_threadid())
+        , time_(std::chrono::system_clock::now())
+    {
+        new (fields_.extend(sizeof(logu::source_location))) logu::source_location(severity, tagname, file, func, line);
+        std::char_traits<char>::copy(threadname_, logu::internal::get_threadname(), sizeof(threadname_));
+    }
+
+    // With the thread and time given explicitly (e.g. for records read back from a binary log)
+    record(logu::severity severity, const char* tagname, const char* file, const char* func, size_t line,
+        uint64_t threadid, const char* threadname, std::chrono::system_clock::time_point time)
+        : location_(nullptr)
+        , threadid_(threadid)
+        , time_(time)
+    {
+        new (fields_.extend(sizeof(logu::source_location))) logu::source_location(severity, tagname, file, func, line);
+        size_t len = 0;
+        while (threadname != nullptr && len < sizeof(threadname_) - 1 && threadname[len] != '\0') {
+            threadname_[len] = threadname[len];
+            ++len;
+        }
+        threadname_[len] = '\0';
+    }
+
+    record() = delete;
+
+    const logu::source_location& location() const
+    {
+        return (location_ != nullptr) ? *location_ : *reinterpret_cast<const logu::source_location*>(fields_.data());
+    };
+    // The location the record was made with by the logging macros, or nullptr if it was made from fields
+    const logu::source_location* static_location() const { return location_; }
+    logu::severity severity() const { return location().severity(); };
+    const char* tagname() const { return location().tagname(); };
+    const char* file() const { return location().file(); };
+    const char* func() const { return location().func(); };
+    size_t line() const { return location().line(); };
+    uint64_t threadid() const { return threadid_; };
+    const char* threadname() const { return threadname_; };
+    std::chrono::system_clock::time_point time() const { return time_; };
+
+    record(record&& rhs)
+        : location_(rhs.location_)
+        , threadid_(rhs.threadid_)
+        , time_(rhs.time_)
+        , suppressed_(rhs.suppressed_)
+        , message_(std::move(rhs.message_))
+        , fields_(std::move(rhs.fields_))
+    {
+        std::char_traits<char>::copy(threadname_, rhs.threadname_, sizeof(threadname_));
+        if (rhs.stream_) {
+            // The stream writes to the buffer of rhs, so make a new one with the same state (e.g. std::hex)
+            stream().copyfmt(*rhs.stream_);
+        }
+    }
+
+    template <typename Type>
+    logu::record& operator<<(const Type& data) &
+    {
+        // Once a stream is in use its state (e.g. std::hex) must apply to every value
+        if (stream_ || !logu::internal::fast_output<Type>::output(message_, data)) {
+            logu::internal::output_wrapper<Type>::output(stream(), data);
+        }
+        return *this;
+    }
+
+    // Keep the temporary created by the logging macros movable to the logger
+    template <typename Type>
+    logu::record&& operator<<(const Type& data) &&
+    {
+        return std::move(*this << data);
+    }
+
+    // printf-style formatting without length limit. Each conversion is checked against the type of its
+    // argument, and a mismatch is written as e.g. "%!d(string)" instead of causing undefined behavior.
+    template <typename... Args>
+    logu::record& format(const char* fmt, const Args&... args) &
+    {
+        const logu::internal::format_arg format_args[] = { logu::internal::make_format_arg(args)..., logu::internal::format_arg() };
+        logu::internal::format_printf(message_, fmt, format_args, sizeof...(Args));
+        return *this;
+    }
+
+    template <typename... Args>
+    logu::record&& format(const char* fmt, const Args&... args) &&
+    {
+        return std::move(format(fmt, args...));
+    }
+
+    // Attach a typed value, kept unformatted for formatters such as logu::json_formatter
+    template <typename ValueType>
+    logu::record& kv(logu::string_view key, const ValueType& value) &
+    {
+        logu::internal::append_field(fields_, key, logu::internal::make_format_arg(value));
+        return *this;
+    }
+
+    template <typename ValueType>
+    logu::record&& kv(logu::string_view key, const ValueType& value) &&
+    {
+        return std::move(kv(key, value));
+    }
+
+    bool has_fields() const { return fields_offset() < fields_.size(); }
+
+    // Call func(const logu::field&) for each field in the order added. Valid while the record is alive.
+    template <typename Func>
+    void for_each_field(Func func) const
+    {
+        logu::internal::for_each_field(fields_, fields_offset(), func);
+    }
+
+    // Number of records dropped by a rate limiting macro before this one
+    logu::record& set_suppressed(uint64_t count) &
+    {
+        suppressed_ = count;
+        return *this;
+    }
+
+    logu::record&& set_suppressed(uint64_t count) &&
+    {
+        return std::move(set_suppressed(count));
+    }
+
+    uint64_t suppressed() const { return suppressed_; }
+
+    std::string message() const
+    {
+        return std::string(message_.data(), message_.size());
+    }
+
+    // Refer to the message without copying it. Valid while the record is alive.
+    logu::string_view message_view() const
+    {
+        return message_.view();
+    }
+
+private:
+    // Records not made by the logging macros keep their location at the start of fields_ and have no pointer,
+    // so that the common case carries only the pointer to the call site
+    const logu::source_location* const location_;
+    const uint64_t threadid_;
+    char threadname_[logu::internal::threadname_size];
+    const std::chrono::system_clock::time_point time_;
+    uint64_t suppressed_ = 0;
+    logu::internal::message_buffer message_;
+    logu::internal::field_buffer fields_;
+    std::unique_ptr<logu::internal::buffer_ostream<logu::internal::message_buffer>> stream_;
+
+    size_t fields_offset() const { return (location_ != nullptr) ? 0 : sizeof(logu::source_location); }
+
+    // Created only for values that need std::ostream formatting
+    std::ostream& stream()
+    {
+        if (!stream_) {
+            stream_.reset(new logu::internal::buffer_ostream<logu::internal::message_buffer>(message_));
+        }
+        return *stream_;
+    }
+};
+
+// Buffer receiving formatted text
+using format_buffer = logu::internal::basic_buffer<512>;
+
+class formatter_base {
+public:
+    virtual ~formatter_base() = default;
+    virtual std::string format(const logu::record& record) = 0;
+
+    // Append the formatted record to the buffer.
+    // The default implementation copies the result of format(); override it to skip the std::string.
+    virtual void format_to(const logu::record& record, logu::format_buffer& buffer)
+    {
+        const auto str = format(record);
+        buffer.append(str.data(), str.size());
+    }
+};
+
+namespace internal {
+    constexpr const char* severity_to_str(logu::severity severity)
+    {
+        return (severity == logu::severity::debug) ? "DEBUG" :
+            (severity == logu::severity::info)     ? "INFO " :
+            (severity == logu::severity::warn)     ? "WARN " :
+            (severity == logu::severity::error)    ? "ERROR" :
+                                                     "-----";
+    }
+
+    inline void append_datetime(const logu::record& record, logu::format_buffer& buffer, bool with_year, bool with_microsecond)
+    {
+        const auto timet = std::chrono::system_clock::to_time_t(record.time());
+        const auto usec = std::chrono::duration_cast<std::chrono::microseconds>(record.time().time_since_epoch()).count() % 1000000;
+        char buf[internal::datetime_size + 7];
+        char* p = internal::format_datetime(buf, timet, with_year);
+        *p++ = '.';
+        if (with_microsecond) {
+            p = internal::format_digits(p, static_cast<uint64_t>(usec), 6);
+        } else {
+            p = internal::format_digits(p, static_cast<uint64_t>(usec / 1000), 3);
+        }
+        buffer.append(buf, static_cast<size_t>(p - buf));
+    }
+
+    // Shortest "%g" form that reads back as the same value, with '.' as the decimal point whatever LC_NUMERIC says
+    inline void append_double(logu::format_buffer& buffer, double value)
+    {
+        char buf[48];
+        int len = std::snprintf(buf, sizeof(buf), "%.15g", value);
+        if (std::strtod(buf, nullptr) != value) {
+            len = std::snprintf(buf, sizeof(buf), "%.17g", value);
+        }
+        size_t size = (len < 0) ? 0 : static_cast<size_t>(len);
+        size = (size < sizeof(buf)) ? size : sizeof(buf) - 1;
+        buffer.append(buf, normalize_decimal_point(buf, size));
+    }
+
+    // Append the string in double quotes with JSON escapes
+    inline void append_json_string(logu::format_buffer& buffer, const char* str, size_t len)
+    {
+        static const char hex[] = "0123456789abcdef";
+        buffer.push_back('"');
+        size_t begin = 0;
+        for (size_t i = 0; i < len; ++i) {
+            const unsigned char c = static_cast<unsigned char>(str[i]);
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+            buffer.append(str + begin, i - begin);
+            begin = i + 1;
+            buffer.push_back('\\');
+            switch (c) {
+            case '"':
+                buffer.push_back('"');
+                break;
+            case '\\':
+                buffer.push_back('\\');
+                break;
+            case '\n':
+                buffer.push_back('n');
+                break;
+            case '\r':
+                buffer.push_back('r');
+                break;
+            case '\t':
+                buffer.push_back('t');
+                break;
+            default:
+                buffer.append("u00", 3);
+                buffer.push_back(hex[c >> 4]);
+                buffer.push_back(hex[c & 0xf]);
+                break;
+            }
+        }
+        buffer.append(str + begin, len - begin);
+        buffer.push_back('"');
+    }
+
+    inline void append_field_value(logu::format_buffer& buffer, const logu::field& f, bool json)
+    {
+        switch (f.value_type) {
+        case logu::field::type::signed_integer:
+            append_integer(buffer, f.i);
+            break;
+        case logu::field::type::unsigned_integer:
+            append_integer(buffer, f.u);
+            break;
+        case logu::field::type::floating:
+            if (json && !std::isfinite(f.d)) {
+                buffer.append("null", 4); // Not representable in JSON
+            } else {
+                append_double(buffer, f.d);
+            }
+            break;
+        case logu::field::type::boolean:
+            buffer.append(f.b ? "true" : "false");
+            break;
+        case logu::field::type::string:
+            if (json) {
+                append_json_string(buffer, f.str.data(), f.str.size());
+            } else {
+                buffer.append(f.str.data(), f.str.size());
+            }
+            break;
+        }
+    }
+
+    // The message followed by the number of suppressed records and the fields, if any
+    inline void append_message(const logu::record& record, logu::format_buffer& buffer)
+    {
+        const auto message = record.message_view();
+        buffer.append(message.data(), message.size());
+        if (record.suppressed() != 0) {
+            buffer.append(" (", 2);
+            append_integer(buffer, record.suppressed());
+            buffer.append(" suppressed)", 12);
+        }
+        record.for_each_field([&buffer](const logu::field& f) {
+            buffer.push_back(' ');
+            buffer.append(f.key.data(), f.key.size());
+            buffer.push_back('=');
+            append_field_value(buffer, f, false);
+        });
+    }
+} // namespace internal
+
+class formatter : public logu::formatter_base {
+public:
+    enum class option {
+        datetime,
+        datetime_year,
+        datetime_microsecond,
+        severity,
+        threadid,
+        threadname,
+        file,
+        func,
+        line,
+        tagname
+    };
+
+public:
+    virtual ~formatter() = default;
+
+    std::string format(const logu::record& record) override
+    {
+        logu::format_buffer buffer;
+        format_to(record, buffer);
+        return std::string(buffer.data(), buffer.size());
+    }
+
+    void format_to(const logu::record& record, logu::format_buffer& buffer) override
+    {
+        if (enabled(option::datetime)) {
+            datetime(record, buffer);
+        }
+        if (enabled(option::severity)) {
+            severity(record, buffer);
+        }
+        if (enabled(option::threadid)) {
+            threadid(record, buffer);
+        }
+        if (enabled(option::threadname)) {
+            threadname(record, buffer);
+        }
+        if (enabled(option::file)) {
+            file(record, buffer);
+        }
+        if (enabled(option::func)) {
+            func(record, buffer);
+        }
+        if (enabled(option::tagname)) {
+            tagname(record, buffer);
+        }
+        logu::internal::append_message(record, buffer);
+    }
+
+    formatter& set_option(option option_, bool enable)
+    {
+        options_[static_cast<size_t>(option_)] = enable;
+        return *this;
+    }
+
+    static constexpr const char* severity_to_str(logu::severity severity)
+    {
+        return logu::internal::severity_to_str(severity);
+    }
+
+private:
+    // Indexed by option
+    std::array<bool, static_cast<size_t>(option::tagname) + 1> options_ = { {
+        true, // datetime
+        true, // datetime_year
+        false, // datetime_microsecond
+        true, // severity
+        true, // threadid
+        false, // threadname
+        true, // file
+        false, // func
+        true, // line
+        true // tagname
+    } };
+
+    bool enabled(option option_) const
+    {
+        return options_[static_cast<size_t>(option_)];
+    }
+
+    void datetime(const logu::record& record, logu::format_buffer& buffer) const
+    {
+        logu::internal::append_datetime(record, buffer, enabled(option::datetime_year), enabled(option::datetime_microsecond));
+        buffer.append(" | ", 3);
+    }
+
+    void severity(const logu::record& record, logu::format_buffer& buffer) const
+    {
+        buffer.append(severity_to_str(record.severity()), 5);
+        buffer.append(" | ", 3);
+    }
+
+    void threadid(const logu::record& record, logu::format_buffer& buffer) const
+    {
+        logu::internal::append_integer(buffer, record.threadid());
+        buffer.append(" | ", 3);
+    }
+
+    void threadname(const logu::record& record, logu::format_buffer& buffer) const
+    {
+        if (!logu::internal::is_null_or_empty(record.threadname())) {
+            buffer.append(record.threadname());
+            buffer.append(" | ", 3);
+        }
+    }
+
+    void file(const logu::record& record, logu::format_buffer& buffer) const
+    {
+        if (!logu::internal::is_null_or_empty(record.file())) {
+            buffer.append(record.file());
+            if (enabled(option::line)) {
+                buffer.push_back('@');
+                logu::internal::append_integer(buffer, record.line());
+            }
+            buffer.append(" | ", 3);
+        }
+    }
+
+    void func(const logu::record& record, logu::format_buffer& buffer) const
+    {
+        if (!logu::internal::is_null_or_empty(record.func())) {
+            buffer.append(record.func());
+            if (enabled(option::line)) {
+                buffer.push_back('@');
+                logu::internal::append_integer(buffer, record.line());
+            }
+            buffer.append(" | ", 3);
+        }
+    }
+
+    void tagname(const logu::record& record, logu::format_buffer& buffer) const
+    {
+        if (!logu::internal::is_null_or_empty(record.tagname())) {
+            buffer.push_back('[');
+            buffer.append(record.tagname());
+            buffer.append("] ", 2);
+        }
+    }
+};
+
+// Formatter built from a pattern such as "{datetime} | {severity} | {tid} | {file}@{line} | {message}".
+// The pattern is parsed once into a list of fields.
+//
+// Fields:
+//   {datetime}    - "YYYY-MM-DD HH:MM:SS.mmm"
+//   {datetime_us} - "YYYY-MM-DD HH:MM:SS.uuuuuu"
+//   {time}        - "MM-DD HH:MM:SS.mmm"
+//   {severity}    - "DEBUG", "INFO ", "WARN ", "ERROR" or "-----"
+//   {tid}         - Thread id
+//   {threadname}  - Thread name
+//   {file}        - File name
+//   {line}        - Line number
+//   {func}        - Function name
+//   {tag}         - Tag name
+//   {message}     - Message, with the number of suppressed records and the fields if any
+// "{{" and "}}" output "{" and "}". Unknown fields are output as they are.
+class pattern_formatter : public logu::formatter_base {
+public:
+    explicit pattern_formatter(const char* pattern = "{datetime} | {severity} | {tid} | {file}@{line} | {message}")
+    {
+        parse(pattern);
+    }
+
+    virtual ~pattern_formatter() = default;
+
+    std::string format(const logu::record& record) override
+    {
+        logu::format_buffer buffer;
+        format_to(record, buffer);
+        return std::string(buffer.data(), buffer.size());
+    }
+
+    void format_to(const logu::record& record, logu::format_buffer& buffer) override
+    {
+        for (const auto& f : fields_) {
+            switch (f.type) {
+            case field_type::literal:
+                buffer.append(literals_.data() + f.offset, f.length);
+                break;
+            case field_type::datetime:
+                logu::internal::append_datetime(record, buffer, true, false);
+                break;
+            case field_type::datetime_us:
+                logu::internal::append_datetime(record, buffer, true, true);
+                break;
+            case field_type::time:
+                logu::internal::append_datetime(record, buffer, false, false);
+                break;
+            case field_type::severity:
+                buffer.append(logu::internal::severity_to_str(record.severity()), 5);
+                break;
+            case field_type::threadid:
+                logu::internal::append_integer(buffer, record.threadid());
+                break;
+            case field_type::threadname:
+                buffer.append(record.threadname());
+                break;
+            case field_type::file:
+                buffer.append(record.file() != nullptr ? record.file() : "");
+                break;
+            case field_type::line:
+                logu::internal::append_integer(buffer, record.line());
+                break;
+            case field_type::func:
+                buffer.append(record.func() != nullptr ? record.func() : "");
+                break;
+            case field_type::tagname:
+                buffer.append(record.tagname() != nullptr ? record.tagname() : "");
+                break;
+            case field_type::message:
+                logu::internal::append_message(record, buffer);
+                break;
+            }
+        }
+    }
+
+private:
+    enum class field_type {
+        literal,
+        datetime,
+        datetime_us,
+        time,
+        severity,
+        threadid,
+        threadname,
+        file,
+        line,
+        func,
+        tagname,
+        message
+    };
+
+    struct field {
+        field_type type;
+        size_t offset; // Position in literals_ (literal only)
+        size_t length;
+    };
+
+    std::string literals_;
+    std::vector<field> fields_;
+
+    void add_literal(const char* s, size_t n)
+    {
+        if (n == 0) {
+            return;
+        }
+        if (!fields_.empty() && fields_.back().type == field_type::literal) {
+            fields_.back().length += n;
+        } else {
+            fields_.push_back({ field_type::literal, literals_.size(), n });
+        }
+        literals_.append(s, n);
+    }
+
+    static bool to_field_type(const std::string& name, field_type& type)
+    {
+        static const std::pair<const char*, field_type> names[] = {
+            { "datetime", field_type::datetime },
+            { "datetime_us", field_type::datetime_us },
+            { "time", field_type::time },
+            { "severity", field_type::severity },
+            { "tid", field_type::threadid },
+            { "threadid", field_type::threadid },
+            { "threadname", field_type::threadname },
+            { "file", field_type::file },
+            { "line", field_type::line },
+            { "func", field_type::func },
+            { "tag", field_type::tagname },
+            { "tagname", field_type::tagname },
+            { "message", field_type::message }
+        };
+        for (const auto& n : names) {
+            if (name == n.first) {
+                type = n.second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void parse(const char* pattern)
+    {
+        const char* p = (pattern != nullptr) ? pattern : "";
+        while (*p != '\0') {
+            if ((p[0] == '{' && p[1] == '{') || (p[0] == '}' && p[1] == '}')) {
+                add_literal(p, 1);
+                p += 2;
+            } else if (*p == '{') {
+                const char* end = p + 1;
+                while (*end != '\0' && *end != '}') {
+                    ++end;
+                }
+                field_type type;
+                if (*end == '}' && to_field_type(std::string(p + 1, end), type)) {
+                    fields_.push_back({ type, 0, 0 });
+                    p = end + 1;
+                } else {
+                    add_literal(p, 1);
+                    ++p;
+                }
+            } else {
+                add_literal(p, 1);
+                ++p;
+            }
+        }
+    }
+};
+
+// Formatter writing one JSON object per record (JSON Lines), e.g.
+// {"time":"2022-01-02 03:04:05.678901","severity":"INFO","tid":123,"tag":"net","file":"main.cpp","line":42,"message":"done","user":7}
+// "threadname" and "tag" are written only when not empty. Fields added with record::kv() follow the message.
+class json_formatter : public logu::formatter_base {
+public:
+    virtual ~json_formatter() = default;
+
+    std::string format(const logu::record& record) override
+    {
+        logu::format_buffer buffer;
+        format_to(record, buffer);
+        return std::string(buffer.data(), buffer.size());
+    }
+
+    void format_to(const logu::record& record, logu::format_buffer& buffer) override
+    {
+        buffer.append("{\"time\":\"", 9);
+        logu::internal::append_datetime(record, buffer, true, true);
+        buffer.append("\",\"severity\":\"", 14);
+        const char* severity = logu::internal::severity_to_str(record.severity());
+        buffer.append(severity, (severity[4] == ' ') ? 4 : 5);
+        buffer.append("\",\"tid\":", 8);
+        logu::internal::append_integer(buffer, record.threadid());
+        if (!logu::internal::is_null_or_empty(record.threadname())) {
+            buffer.append(",\"threadname\":", 14);
+            append_string(buffer, record.threadname());
+        }
+        if (!logu::internal::is_null_or_empty(record.tagname())) {
+            buffer.append(",\"tag\":", 7);
+            append_string(buffer, record.tagname());
+        }
+        buffer.append(",\"file\":", 8);
+        append_string(buffer, record.file() != nullptr ? record.file() : "");
+        buffer.append(",\"line\":", 8);
+        logu::internal::append_integer(buffer, record.line());
+        buffer.append(",\"message\":", 11);
+        const auto message = record.message_view();
+        logu::internal::append_json_string(buffer, message.data(), message.size());
+        if (record.suppressed() != 0) {
+            buffer.append(",\"suppressed\":", 14);
+            logu::internal::append_integer(buffer, record.suppressed());
+        }
+        record.for_each_field([&buffer](const logu::field& f) {
+            buffer.push_back(',');
+            logu::internal::append_json_string(buffer, f.key.data(), f.key.size());
+            buffer.push_back(':');
+            logu::internal::append_field_value(buffer, f, true);
+        });
+        buffer.push_back('}');
+    }
+
+private:
+    static void append_string(logu::format_buffer& buffer, const char* str)
+    {
+        logu::internal::append_json_string(buffer, str, std::char_traits<char>::length(str));
+    }
+};
+
+class sink_base;
+
+namespace internal {
+    // Sinks written out by the crash handler. A plain array of atomics so that it is
+    // zero-initialized before any code runs and can be read from a signal handler.
+    template <typename SinkType = logu::sink_base>
+    struct emergency_sinks {
+        static constexpr size_t capacity = 64;
+        static std::atomic<SinkType*> slots[capacity];
+
+        static void add(SinkType* sink)
+        {
+            for (auto& slot : slots) {
+                if (slot.load(std::memory_order_acquire) == sink) {
+                    return;
+                }
+            }
+            for (auto& slot : slots) {
+                SinkType* expected = nullptr;
+                if (slot.compare_exchange_strong(expected, sink, std::memory_order_acq_rel)) {
+                    return;
+                }
+            }
+        }
+
+        static void remove(SinkType* sink)
+        {
+            for (auto& slot : slots) {
+                SinkType* expected = sink;
+                slot.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+            }
+        }
+    };
+
+    template <typename SinkType>
+    std::atomic<SinkType*> emergency_sinks<SinkType>::slots[emergency_sinks<SinkType>::capacity];
+
+#if defined(__unix__) || defined(__APPLE__)
+    // Async-signal-safe write of the whole data. Gives up on errors other than EINTR and EAGAIN.
+    inline void write_fully(int fd, const char* data, size_t len)
+    {
+        while (fd >= 0 && len > 0) {
+            const ssize_t written = ::write(fd, data, len);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                struct pollfd pfd = {};
+                pfd.fd = fd;
+                pfd.events = POLLOUT;
+                if ((errno == EAGAIN || errno == EWOULDBLOCK) && (::poll(&pfd, 1, -1) >= 0 || errno == EINTR)) {
+                    continue;
+                }
+                return;
+            }
+            data += written;
+            len -= static_cast<size_t>(written);
+        }
+    }
+#endif
+
+    // Thread calling func every interval until destroyed, so that buffered lines are written
+    // even when no record follows them
+    class flush_timer : noncopyable {
+    public:
+        flush_timer(std::chrono::milliseconds interval, std::function<void()> func)
+            : interval_(interval)
+            , func_(std::move(func))
+            , thread_([this]() { run(); })
+        {
+        }
+
+        ~flush_timer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                stop_ = true;
+            }
+            cv_.notify_one();
+            thread_.join();
+        }
+
+    private:
+        const std::chrono::milliseconds interval_;
+        const std::function<void()> func_;
+        bool stop_ = false;
+        std::mutex mtx_;
+        std::condition_variable cv_;
+        std::thread thread_;
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            while (!cv_.wait_for(lock, interval_, [this]() { return stop_; })) {
+                lock.unlock();
+                func_();
+                lock.lock();
+            }
+        }
+    };
+} // namespace internal
+
+// Destination of formatted records, passed to logger::set_handler as std::shared_ptr.
+// A sink may be shared by several loggers, so implementations must be thread safe.
+class sink_base {
+public:
+    virtual ~sink_base() = default;
+    virtual void write(const logu::record& record, const char* str, size_t len) = 0;
+    virtual void flush() { }
+
+    // Return false if write() does not use the formatted text
+    virtual bool needs_text() const { return true; }
+
+    // Write out buffered data with async-signal-safe calls only (see logu::install_crash_handler).
+    // Called without locks while the process is crashing, so a record being written may be lost.
+    virtual void emergency_flush() { }
+
+protected:
+    // Register for emergency_flush. Sinks doing so must call disable_emergency_flush first in their destructor.
+    void enable_emergency_flush() { logu::internal::emergency_sinks<>::add(this); }
+    void disable_emergency_flush() { logu::internal::emergency_sinks<>::remove(this); }
+};
+
+// When a buffering sink writes its buffer out
+class flush_policy {
+public:
+    // Flush when the buffer holds the given number of bytes
+    flush_policy& set_buffer_size(size_t size)
+    {
+        buffer_size_ = size;
+        return *this;
+    }
+
+    // Flush when the given time has passed since the last flush, by a timer thread the sink starts
+    // at its first write so that quiet periods do not hold lines back (zero to disable)
+    flush_policy& set_interval(std::chrono::milliseconds interval)
+    {
+        interval_ = interval;
+        return *this;
+    }
+
+    // Flush on every record at or above the given severity
+    flush_policy& set_severity(logu::severity severity)
+    {
+        severity_ = severity;
+        return *this;
+    }
+
+    size_t buffer_size() const { return buffer_size_; }
+    std::chrono::milliseconds interval() const { return interval_; }
+    logu::severity severity() const { return severity_; }
+
+private:
+    size_t buffer_size_ = 64 * 1024;
+    std::chrono::milliseconds interval_ = std::chrono::milliseconds(1000);
+    logu::severity severity_ = logu::severity::error;
+};
+
+// Sink writing lines to a file through its own buffer according to a flush_policy
+class file_sink : public logu::sink_base {
+public:
+    explicit file_sink(const char* filename, const logu::flush_policy& policy = logu::flush_policy())
+        : file_sink(filename, "w", policy)
+    {
+    }
+
+    // Not owned file such as stdout
+    explicit file_sink(std::FILE* file, const logu::flush_policy& policy = logu::flush_policy())
+        : file_(file)
+        , owned_(false)
+        , policy_(policy)
+    {
+        buffer_.reserve(policy_.buffer_size() + 256);
+        set_emergency_file(file_);
+    }
+
+    virtual ~file_sink()
+    {
+        disable_emergency_flush();
+        stop_flush_timer();
+        flush();
+        if (owned_ && file_ != nullptr) {
+            std::fclose(file_);
+        }
+    }
+
+    virtual bool is_open() const { return file_ != nullptr; }
+
+    void write(const logu::record& record, const char* str, size_t len) override
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        encode(record, str, len, buffer_);
+        if (buffer_.size() >= policy_.buffer_size() || policy_.severity() <= record.severity()) {
+            flush_internal();
+        } else if (policy_.interval().count() > 0 && policy_.interval() <= std::chrono::steady_clock::now() - last_flush_) {
+            flush_internal();
+        } else if (policy_.interval().count() > 0 && !timer_) {
+            // Started here rather than in the constructor, when derived sinks are fully constructed
+            timer_.reset(new logu::internal::flush_timer(policy_.interval(), [this]() { flush_if_due(); }));
+        }
+    }
+
+    void flush() override
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        flush_internal();
+    }
+
+    void emergency_flush() override
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        logu::internal::write_fully(emergency_fd_.load(std::memory_order_relaxed), buffer_.data(), buffer_.size());
+#endif
+    }
+
+protected:
+    file_sink(const char* filename, const char* mode, const logu::flush_policy& policy)
+        : file_(std::fopen(filename, mode))
+        , owned_(true)
+        , policy_(policy)
+    {
+        if (file_ != nullptr) {
+            // The sink buffers by itself, so let every flush go straight to the file
+            std::setvbuf(file_, nullptr, _IONBF, 0);
+        }
+        buffer_.reserve(policy_.buffer_size() + 256);
+        set_emergency_file(file_);
+    }
+
+    // For derived sinks that manage files by themselves through write_out
+    explicit file_sink(const logu::flush_policy& policy)
+        : file_(nullptr)
+        , owned_(false)
+        , policy_(policy)
+    {
+        buffer_.reserve(policy_.buffer_size() + 256);
+    }
+
+    // Append the data written for a record to the buffer. Called with the sink locked.
+    virtual void encode(const logu::record& record, const char* str, size_t len, std::string& buffer)
+    {
+        (void)record;
+        buffer.append(str, len);
+        buffer.push_back('\n');
+    }
+
+    // Write out the buffered lines. Called with the sink locked.
+    virtual void write_out(const char* data, size_t len)
+    {
+        if (file_ != nullptr) {
+            std::fwrite(data, 1, len, file_);
+            std::fflush(file_);
+        }
+    }
+
+    // Stop the interval flushes. Derived sinks must call this first in their destructor.
+    void stop_flush_timer() { timer_.reset(); }
+
+    // File the buffer goes to on emergency_flush. Derived sinks writing to other files update it.
+    void set_emergency_file(std::FILE* file)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        if (file != nullptr) {
+            emergency_fd_.store(::fileno(file), std::memory_order_relaxed);
+            enable_emergency_flush();
+        }
+#else
+        (void)file;
+#endif
+    }
+
+private:
+    std::FILE* file_;
+    const bool owned_;
+    const logu::flush_policy policy_;
+    std::string buffer_;
+    std::atomic<int> emergency_fd_ { -1 };
+    std::chrono::steady_clock::time_point last_flush_ = std::chrono::steady_clock::now();
+    std::mutex mtx_;
+    std::unique_ptr<logu::internal::flush_timer> timer_;
+
+    void flush_internal()
+    {
+        if (!buffer_.empty()) {
+            write_out(buffer_.data(), buffer_.size());
+        }
+        buffer_.clear();
+        last_flush_ = std::chrono::steady_clock::now();
+    }
+
+    void flush_if_due()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (policy_.interval() <= std::chrono::steady_clock::now() - last_flush_) {
+            flush_internal();
+        }
+    }
+};
+
+// When a rotating_file_sink starts a new file
+class rotation_policy {
+public:
+    // Rotate when the file would exceed the given number of bytes (zero to disable)
+    rotation_policy& set_max_size(size_t size)
+    {
+        max_size_ = size;
+        return *this;
+    }
+
+    // Rotate at every multiple of the given wall-clock interval, e.g. every hour on the hour (zero to disable)
+    rotation_policy& set_interval(std::chrono::seconds interval)
+    {
+        interval_ = interval;
+        return *this;
+    }
+
+    // Number of rotated files to keep, including those found from earlier runs
+    rotation_policy& set_max_files(size_t count)
+    {
+        max_files_ = count;
+        return *this;
+    }
+
+    size_t max_size() const { return max_size_; }
+    std::chrono::seconds interval() const { return interval_; }
+    size_t max_files() const { return max_files_; }
+
+private:
+    size_t max_size_ = 10 * 1024 * 1024;
+    std::chrono::seconds interval_ = std::chrono::seconds(0);
+    size_t max_files_ = 5;
+};
+
+// Sink writing to filename and moving it to "filename.YYYYMMDD-HHMMSS" on rotation.
+// The next file is opened in advance as "filename.next" by a background thread, which also renames
+// and deletes files, so rotation in the logging thread is only a swap of file handles.
+// Rotation is checked each time buffered lines are written out.
+class rotating_file_sink : public logu::file_sink {
+public:
+    explicit rotating_file_sink(const char* filename, const logu::rotation_policy& rotation = logu::rotation_policy(), const logu::flush_policy& policy = logu::flush_policy())
+        : logu::file_sink(policy)
+        , filename_(filename)
+        , spare_filename_(filename_ + ".next")
+        , rotation_(rotation)
+    {
+        active_ = std::fopen(filename, "a");
+        if (active_ != nullptr) {
+            std::setvbuf(active_, nullptr, _IONBF, 0);
+            std::fseek(active_, 0, SEEK_END);
+            const long pos = std::ftell(active_);
+            size_ = (pos > 0) ? static_cast<size_t>(pos) : 0;
+        }
+        set_emergency_file(active_);
+        next_rotation_ = next_rotation_time();
+        rotated_filenames_ = find_rotated_files();
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    virtual ~rotating_file_sink()
+    {
+        disable_emergency_flush();
+        stop_flush_timer();
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(rotator_mtx_);
+            stop_ = true;
+        }
+        rotator_cv_.notify_one();
+        thread_.join();
+        if (active_ != nullptr) {
+            std::fclose(active_);
+        }
+        if (spare_ != nullptr) {
+            std::fclose(spare_);
+            std::remove(spare_filename_.c_str());
+        }
+    }
+
+    bool is_open() const override { return active_ != nullptr; }
+
+    // Rotated files kept at the moment, oldest first
+    std::vector<std::string> rotated_filenames() const
+    {
+        std::lock_guard<std::mutex> lock(filenames_mtx_);
+        return rotated_filenames_;
+    }
+
+protected:
+    void write_out(const char* data, size_t len) override
+    {
+        if (should_rotate(len)) {
+            rotate();
+        }
+        if (active_ != nullptr) {
+            std::fwrite(data, 1, len, active_);
+            std::fflush(active_);
+            size_ += len;
+        }
+    }
+
+private:
+    const std::string filename_;
+    const std::string spare_filename_;
+    const logu::rotation_policy rotation_;
+    std::FILE* active_ = nullptr;
+    size_t size_ = 0;
+    std::chrono::system_clock::time_point next_rotation_;
+
+    // Shared with the rotator thread
+    std::FILE* spare_ = nullptr;
+    std::vector<std::FILE*> retired_;
+    bool stop_ = false;
+    std::mutex rotator_mtx_;
+    std::condition_variable rotator_cv_;
+    std::vector<std::string> rotated_filenames_;
+    mutable std::mutex filenames_mtx_;
+    std::thread thread_;
+
+    std::chrono::system_clock::time_point next_rotation_time() const
+    {
+        if (rotation_.interval().count() <= 0) {
+            return std::chrono::system_clock::time_point::max();
+        }
+        const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch());
+        return std::chrono::system_clock::time_point((now / rotation_.interval() + 1) * rotation_.interval());
+    }
+
+    bool should_rotate(size_t len) const
+    {
+        return (0 < rotation_.max_size() && 0 < size_ && rotation_.max_size() < size_ + len) || next_rotation_ <= std::chrono::system_clock::now();
+    }
+
+    void rotate()
+    {
+        std::lock_guard<std::mutex> lock(rotator_mtx_);
+        if (spare_ == nullptr) {
+            // The next file is not ready yet. Keep writing to the current one rather than waiting.
+            return;
+        }
+        retired_.push_back(active_);
+        active_ = spare_;
+        spare_ = nullptr;
+        size_ = 0;
+        set_emergency_file(active_);
+        next_rotation_ = next_rotation_time();
+        rotator_cv_.notify_one();
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(rotator_mtx_);
+        for (;;) {
+            rotator_cv_.wait(lock, [this]() { return stop_ || !retired_.empty() || spare_ == nullptr; });
+            if (stop_ && retired_.empty()) {
+                break;
+            }
+            std::vector<std::FILE*> retired;
+            retired.swap(retired_);
+            const bool need_spare = !stop_ && spare_ == nullptr;
+            lock.unlock();
+
+            for (auto file : retired) {
+                if (file != nullptr) {
+                    std::fclose(file);
+                }
+                move_to_rotated_file();
+            }
+            std::FILE* spare = need_spare ? std::fopen(spare_filename_.c_str(), "w") : nullptr;
+            if (spare != nullptr) {
+                std::setvbuf(spare, nullptr, _IONBF, 0);
+            }
+
+            lock.lock();
+            if (need_spare) {
+                spare_ = spare;
+                if (spare == nullptr) {
+                    // Retry later instead of spinning on a failing open
+                    rotator_cv_.wait_for(lock, std::chrono::seconds(1));
+                }
+            }
+        }
+    }
+
+    void move_to_rotated_file()
+    {
+        const time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        struct tm localt = {};
+        logu::internal::localtime_s(&localt, &now);
+        char suffix[16];
+        std::strftime(suffix, sizeof(suffix), "%Y%m%d-%H%M%S", &localt);
+        std::string rotated_filename = filename_ + "." + suffix;
+        for (int i = 1; file_exists(rotated_filename); ++i) {
+            rotated_filename = filename_ + "." + suffix + "-" + std::to_string(i);
+        }
+        std::rename(filename_.c_str(), rotated_filename.c_str());
+        std::rename(spare_filename_.c_str(), filename_.c_str());
+
+        std::lock_guard<std::mutex> lock(filenames_mtx_);
+        rotated_filenames_.push_back(rotated_filename);
+        while (rotation_.max_files() < rotated_filenames_.size()) {
+            std::remove(rotated_filenames_.front().c_str());
+            rotated_filenames_.erase(rotated_filenames_.begin());
+        }
+    }
+
+    // Rotated files left by earlier runs, oldest first, so that max_files counts them too
+    std::vector<std::string> find_rotated_files() const
+    {
+#if defined(_WIN32)
+        const size_t slash = filename_.find_last_of("/\\");
+#else
+        const size_t slash = filename_.find_last_of('/');
+#endif
+        const std::string dir = (slash == std::string::npos) ? "" : filename_.substr(0, slash + 1);
+        const std::string prefix = filename_.substr(dir.size()) + ".";
+        std::vector<std::pair<std::string, unsigned long>> found; // Timestamp and counter
+        const auto add = [&](const char* name) {
+            if (std::strncmp(name, prefix.c_str(), prefix.size()) != 0) {
+                return;
+            }
+            const char* suffix = name + prefix.size();
+            unsigned long counter = 0;
+            if (parse_rotated_suffix(suffix, counter)) {
+                found.emplace_back(std::string(suffix, 15), counter);
+            }
+        };
+#if defined(_WIN32)
+        struct _finddata_t data;
+        const intptr_t handle = ::_findfirst((dir + prefix + "*").c_str(), &data);
+        if (handle != -1) {
+            do {
+                add(data.name);
+            } while (::_findnext(handle, &data) == 0);
+            ::_findclose(handle);
+        }
+#elif defined(__unix__) || defined(__APPLE__)
+        DIR* d = ::opendir(dir.empty() ? "." : dir.c_str());
+        if (d != nullptr) {
+            while (const struct dirent* entry = ::readdir(d)) {
+                add(entry->d_name);
+            }
+            ::closedir(d);
+        }
+#endif
+        std::sort(found.begin(), found.end());
+        std::vector<std::string> filenames;
+        for (const auto& f : found) {
+            filenames.push_back(filename_ + "." + f.first + ((f.second != 0) ? "-" + std::to_string(f.second) : ""));
+        }
+        return filenames;
+    }
+
+    // Match "YYYYMMDD-HHMMSS" optionally followed by "-N" as written by move_to_rotated_file
+    static bool parse_rotated_suffix(const char* suffix, unsigned long& counter)
+    {
+        for (int i = 0; i < 15; ++i) {
+            const bool ok = (i == 8) ? suffix[i] == '-' : (suffix[i] >= '0' && suffix[i] <= '9');
+            if (!ok) {
+                return false;
+            }
+        }
+        if (suffix[15] == '\0') {
+            counter = 0;
+            return true;
+        }
+        if (suffix[15] != '-' || suffix[16] == '\0') {
+            return false;
+        }
+        char* end = nullptr;
+        counter = std::strtoul(suffix + 16, &end, 10);
+        return *end == '\0' && counter != 0 && suffix[16] >= '0' && suffix[16] <= '9';
+    }
+
+    static bool file_exists(const std::string& filename)
+    {
+        std::FILE* file = std::fopen(filename.c_str(), "r");
+        if (file != nullptr) {
+            std::fclose(file);
+        }
+        return file != nullptr;
+    }
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+// Sink collecting lines in pooled chunks and writing them to a file descriptor with writev,
+// so a flush costs one system call for up to IOV_MAX chunks however many records it holds.
+// Partial writes are resumed, and a non-blocking descriptor is waited on with poll.
+class writev_sink : public logu::sink_base {
+public:
+    // Not owned descriptor such as STDOUT_FILENO
+    explicit writev_sink(int fd, const logu::flush_policy& policy = logu::flush_policy())
+        : fd_(fd)
+        , owned_(false)
+        , policy_(policy)
+    {
+        enable_emergency_flush();
+    }
+
+    explicit writev_sink(const char* filename, const logu::flush_policy& policy = logu::flush_policy())
+        : fd_(::open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+        , owned_(true)
+        , policy_(policy)
+    {
+        enable_emergency_flush();
+    }
+
+    virtual ~writev_sink()
+    {
+        disable_emergency_flush();
+        timer_.reset();
+        flush();
+        if (owned_ && fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+
+    void write(const logu::record& record, const char* str, size_t len) override
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        append(str, len);
+        append("\n", 1);
+        if (size_ >= policy_.buffer_size() || policy_.severity() <= record.severity()) {
+            flush_internal();
+        } else if (policy_.interval().count() > 0 && policy_.interval() <= std::chrono::steady_clock::now() - last_flush_) {
+            flush_internal();
+        } else if (policy_.interval().count() > 0 && !timer_) {
+            timer_.reset(new logu::internal::flush_timer(policy_.interval(), [this]() { flush_if_due(); }));
+        }
+    }
+
+    void flush() override
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        flush_internal();
+    }
+
+    void emergency_flush() override
+    {
+        for (size_t i = 0; i < used_ && i < chunks_.size(); ++i) {
+            logu::internal::write_fully(fd_, chunks_[i].get(), (i + 1 == used_) ? tail_ : static_cast<size_t>(chunk_size));
+        }
+    }
+
+    // Number of writev calls made so far
+    uint64_t writev_calls() const { return writev_calls_.load(std::memory_order_relaxed); }
+
+private:
+    enum { chunk_size = 16 * 1024 };
+
+    const int fd_;
+    const bool owned_;
+    const logu::flush_policy policy_;
+    std::vector<std::unique_ptr<char[]>> chunks_; // Chunks beyond used_ are the pool
+    size_t used_ = 0; // Chunks holding data, the last one possibly partially
+    size_t tail_ = 0; // Bytes in the last used chunk
+    size_t size_ = 0; // Bytes buffered in total
+    std::vector<struct iovec> iov_;
+    std::chrono::steady_clock::time_point last_flush_ = std::chrono::steady_clock::now();
+    std::atomic<uint64_t> writev_calls_ { 0 };
+    std::mutex mtx_;
+    std::unique_ptr<logu::internal::flush_timer> timer_;
+
+    void flush_if_due()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (policy_.interval() <= std::chrono::steady_clock::now() - last_flush_) {
+            flush_internal();
+        }
+    }
+
+    void append(const char* data, size_t len)
+    {
+        while (len > 0) {
+            if (used_ == 0 || tail_ == chunk_size) {
+                if (used_ == chunks_.size()) {
+                    chunks_.emplace_back(new char[chunk_size]);
+                }
+                ++used_;
+                tail_ = 0;
+            }
+            const size_t n = (len < chunk_size - tail_) ? len : chunk_size - tail_;
+            std::memcpy(chunks_[used_ - 1].get() + tail_, data, n);
+            tail_ += n;
+            size_ += n;
+            data += n;
+            len -= n;
+        }
+    }
+
+    static size_t iov_max()
+    {
+#if defined(IOV_MAX)
+        return IOV_MAX;
+#else
+        return 1024;
+#endif
+    }
+
+    void flush_internal()
+    {
+        last_flush_ = std::chrono::steady_clock::now();
+        if (size_ == 0) {
+            return;
+        }
+        iov_.resize(used_);
+        for (size_t i = 0; i < used_; ++i) {
+            iov_[i].iov_base = chunks_[i].get();
+            iov_[i].iov_len = (i + 1 == used_) ? tail_ : static_cast<size_t>(chunk_size);
+        }
+        if (fd_ >= 0) {
+            write_all();
+        }
+
+        // Keep as many chunks as a full buffer needs and release the rest
+        const size_t keep = policy_.buffer_size() / chunk_size + 1;
+        if (chunks_.size() > keep) {
+            chunks_.resize(keep);
+        }
+        used_ = 0;
+        tail_ = 0;
+        size_ = 0;
+    }
+
+    void write_all()
+    {
+        size_t first = 0;
+        while (first < iov_.size()) {
+            const size_t count = (iov_.size() - first < iov_max()) ? iov_.size() - first : iov_max();
+            writev_calls_.fetch_add(1, std::memory_order_relaxed);
+            const ssize_t written = ::writev(fd_, &iov_[first], static_cast<int>(count));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    struct pollfd pfd = {};
+                    pfd.fd = fd_;
+                    pfd.events = POLLOUT;
+                    if (::poll(&pfd, 1, -1) >= 0 || errno == EINTR) {
+                        continue;
+                    }
+                }
+                // Unrecoverable, so the buffered lines are dropped
+                return;
+            }
+
+            // Skip the fully written chunks and resume in the middle of a partially written one
+            size_t remaining = static_cast<size_t>(written);
+            while (first < iov_.size() && iov_[first].iov_len <= remaining) {
+                remaining -= iov_[first].iov_len;
+                ++first;
+            }
+            if (remaining > 0) {
+                iov_[first].iov_base = static_cast<char*>(iov_[first].iov_base) + remaining;
+                iov_[first].iov_len -= remaining;
+            }
+        }
+    }
+};
+#endif
+
+// What an asynchronous logger does when its queue is full (see logger::set_async),
+// or an async_file_sink when all its buffers are being written (see async_io_policy::set_backpressure)
+class backpressure_policy {
+public:
+    enum class overflow {
+        block, // Wait until the worker makes room
+        drop_newest, // Drop the record being logged
+        drop_oldest // Drop the oldest queued record to make room
+    };
+
+    backpressure_policy& set_overflow(overflow action)
+    {
+        overflow_ = action;
+        return *this;
+    }
+
+    // Drop records below the given severity when full, whatever set_overflow says
+    backpressure_policy& set_drop_below(logu::severity severity)
+    {
+        drop_below_ = severity;
+        return *this;
+    }
+
+    // Treat the queue as full when the queued records take the given number of bytes (zero to disable)
+    backpressure_policy& set_max_bytes(size_t bytes)
+    {
+        max_bytes_ = bytes;
+        return *this;
+    }
+
+    // Output "N records dropped" at most once per interval. flush() outputs it regardless.
+    backpressure_policy& set_report_interval(std::chrono::milliseconds interval)
+    {
+        report_interval_ = interval;
+        return *this;
+    }
+
+    overflow get_overflow() const { return overflow_; }
+    logu::severity drop_below() const { return drop_below_; }
+    size_t max_bytes() const { return max_bytes_; }
+    std::chrono::milliseconds report_interval() const { return report_interval_; }
+
+private:
+    overflow overflow_ = overflow::block;
+    logu::severity drop_below_ = logu::severity::debug;
+    size_t max_bytes_ = 0;
+    std::chrono::milliseconds report_interval_ = std::chrono::milliseconds(1000);
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+// How an async_file_sink writes its buffers
+class async_io_policy {
+public:
+    // Number of buffers of flush_policy::buffer_size bytes. Writing waits only when all of them are being written.
+    async_io_policy& set_buffer_count(size_t count)
+    {
+        buffer_count_ = (count < 2) ? 2 : count;
+        return *this;
+    }
+
+    // Call fdatasync after each buffer is written
+    async_io_policy& set_datasync(bool enable)
+    {
+        datasync_ = enable;
+        return *this;
+    }
+
+    // Number of pwrite threads used when io_uring is not available
+    async_io_policy& set_threads(size_t count)
+    {
+        threads_ = (count < 1) ? 1 : count;
+        return *this;
+    }
+
+    // Use io_uring when built with LOGU_ENABLE_IO_URING and supported by the kernel
+    async_io_policy& set_io_uring(bool enable)
+    {
+        io_uring_ = enable;
+        return *this;
+    }
+
+    // What writing does when a line does not fit in the buffers that are not being written.
+    // Buffers being written cannot be taken back, so drop_oldest drops the new line like drop_newest,
+    // and max_bytes does not apply since the buffers already bound the memory.
+    async_io_policy& set_backpressure(const logu::backpressure_policy& policy)
+    {
+        backpressure_ = policy;
+        return *this;
+    }
+
+    size_t buffer_count() const { return buffer_count_; }
+    bool datasync() const { return datasync_; }
+    size_t threads() const { return threads_; }
+    bool io_uring() const { return io_uring_; }
+    const logu::backpressure_policy& backpressure() const { return backpressure_; }
+
+private:
+    size_t buffer_count_ = 8;
+    bool datasync_ = false;
+    size_t threads_ = 2;
+    bool io_uring_ = true;
+    logu::backpressure_policy backpressure_;
+};
+
+namespace internal {
+    // Writes whole buffers of an async_file_sink at given offsets and reports each completion
+    class io_backend : noncopyable {
+    public:
+        using functype_done = std::function<void(size_t index, bool ok)>;
+
+        virtual ~io_backend() = default;
+        // Return false if the buffer could not be queued, in which case done is not called for it
+        virtual bool submit(size_t index, const char* data, size_t len, uint64_t offset) = 0;
+        virtual bool is_io_uring() const { return false; }
+    };
+
+    inline bool datasync(int fd)
+    {
+#if defined(__APPLE__)
+        return ::fsync(fd) == 0;
+#else
+        return ::fdatasync(fd) == 0;
+#endif
+    }
+
+    // Portable backend running pwrite on a small thread pool
+    class pwrite_backend : public io_backend {
+    public:
+        pwrite_backend(int fd, bool sync, size_t threads, functype_done done)
+            : fd_(fd)
+            , sync_(sync)
+            , done_(std::move(done))
+        {
+            for (size_t i = 0; i < threads; ++i) {
+                threads_.emplace_back([this]() { run(); });
+            }
+        }
+
+        ~pwrite_backend()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            for (auto& thread : threads_) {
+                thread.join();
+            }
+        }
+
+        bool submit(size_t index, const char* data, size_t len, uint64_t offset) override
+        {
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                jobs_.push_back(job { index, data, len, offset });
+            }
+            cv_.notify_one();
+            return true;
+        }
+
+    private:
+        struct job {
+            size_t index;
+            const char* data;
+            size_t len;
+            uint64_t offset;
+        };
+
+        const int fd_;
+        const bool sync_;
+        const functype_done done_;
+        std::deque<job> jobs_;
+        bool stop_ = false;
+        std::mutex mtx_;
+        std::condition_variable cv_;
+        std::vector<std::thread> threads_;
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            for (;;) {
+                cv_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+                if (jobs_.empty()) {
+                    break;
+                }
+                job j = jobs_.front();
+                jobs_.pop_front();
+                lock.unlock();
+                done_(j.index, write_job(j));
+                lock.lock();
+            }
+        }
+
+        bool write_job(job j) const
+        {
+            while (j.len > 0) {
+                const ssize_t written = ::pwrite(fd_, j.data, j.len, static_cast<off_t>(j.offset));
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                j.data += written;
+                j.len -= static_cast<size_t>(written);
+                j.offset += static_cast<uint64_t>(written);
+            }
+            return !sync_ || datasync(fd_);
+        }
+    };
+
+#if defined(LOGU_INTERNAL_IO_URING)
+    // Backend submitting fixed buffer writes to an io_uring through raw system calls.
+    // Submission happens in the calling thread, and a completion thread resubmits short writes,
+    // issues fdatasync when requested and reports completions.
+    // A write the kernel refuses to queue is reported as failed instead of being retried forever.
+    class io_uring_backend : public io_backend {
+    public:
+        // Return nullptr if the kernel does not allow io_uring or buffer registration
+        static std::unique_ptr<io_backend> create(int fd, bool sync, const std::vector<struct iovec>& buffers, functype_done done)
+        {
+            std::unique_ptr<io_uring_backend> backend(new io_uring_backend(fd, sync, std::move(done)));
+            if (!backend->setup(buffers)) {
+                return nullptr;
+            }
+            io_uring_backend* self = backend.get();
+            backend->thread_ = std::thread([self]() { self->run(); });
+            return std::unique_ptr<io_backend>(backend.release());
+        }
+
+        ~io_uring_backend()
+        {
+            if (thread_.joinable()) {
+                // The completion thread waits on the ring and on wake_fd_, so stopping does not need the ring
+                stop_.store(true);
+                const uint64_t one = 1;
+                while (::write(wake_fd_, &one, sizeof(one)) < 0 && errno == EINTR) {
+                }
+                thread_.join();
+            }
+            if (wake_fd_ >= 0) {
+                ::close(wake_fd_);
+            }
+            if (sqes_ != nullptr) {
+                ::munmap(sqes_, sqes_size_);
+            }
+            if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+                ::munmap(cq_ring_, cq_ring_size_);
+            }
+            if (sq_ring_ != nullptr) {
+                ::munmap(sq_ring_, sq_ring_size_);
+            }
+            if (ring_fd_ >= 0) {
+                ::close(ring_fd_);
+            }
+        }
+
+        bool submit(size_t index, const char* data, size_t len, uint64_t offset) override
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            jobs_[index] = job { data, len, offset };
+            return push(IORING_OP_WRITE_FIXED, index * 2);
+        }
+
+        bool is_io_uring() const override { return true; }
+
+    private:
+        struct job {
+            const char* data;
+            size_t len;
+            uint64_t offset;
+        };
+
+        // user_data is the buffer index times two, plus one for fdatasync
+        const int fd_;
+        const bool sync_;
+        const functype_done done_;
+        int ring_fd_ = -1;
+        int wake_fd_ = -1;
+        std::atomic<bool> stop_ { false };
+        void* sq_ring_ = nullptr;
+        void* cq_ring_ = nullptr;
+        struct io_uring_sqe* sqes_ = nullptr;
+        size_t sq_ring_size_ = 0;
+        size_t cq_ring_size_ = 0;
+        size_t sqes_size_ = 0;
+        unsigned* sq_tail_ = nullptr;
+        unsigned* sq_mask_ = nullptr;
+        unsigned* sq_array_ = nullptr;
+        unsigned* cq_head_ = nullptr;
+        unsigned* cq_tail_ = nullptr;
+        unsigned* cq_mask_ = nullptr;
+        struct io_uring_cqe* cqes_ = nullptr;
+        std::vector<job> jobs_;
+        std::mutex mtx_; // Guards the submission queue and jobs_
+        std::thread thread_;
+
+        io_uring_backend(int fd, bool sync, functype_done done)
+            : fd_(fd)
+            , sync_(sync)
+            , done_(std::move(done))
+        {
+        }
+
+        static int enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+        {
+            return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+        }
+
+        bool setup(const std::vector<struct iovec>& buffers)
+        {
+            struct io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+            // Room for a write or fdatasync per buffer
+            ring_fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, static_cast<unsigned>(buffers.size()), &params));
+            wake_fd_ = ::eventfd(0, EFD_CLOEXEC);
+            if (ring_fd_ < 0 || wake_fd_ < 0) {
+                return false;
+            }
+
+            sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+            const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single_mmap) {
+                sq_ring_size_ = cq_ring_size_ = (sq_ring_size_ < cq_ring_size_) ? cq_ring_size_ : sq_ring_size_;
+            }
+            sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+            if (sq_ring_ == nullptr) {
+                return false;
+            }
+            cq_ring_ = single_mmap ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+            sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+            sqes_ = static_cast<struct io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+            if (cq_ring_ == nullptr || sqes_ == nullptr) {
+                return false;
+            }
+
+            char* sq = static_cast<char*>(sq_ring_);
+            sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            char* cq = static_cast<char*>(cq_ring_);
+            cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+            jobs_.resize(buffers.size());
+            return ::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS, buffers.data(), static_cast<unsigned>(buffers.size())) == 0;
+        }
+
+        void* map(size_t size, off_t offset) const
+        {
+            void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+            return (ptr == MAP_FAILED) ? nullptr : ptr;
+        }
+
+        // Queue an entry and submit it, false if the kernel refused it. Called with mtx_ held.
+        bool push(uint8_t opcode, uint64_t user_data)
+        {
+            const unsigned tail = *sq_tail_;
+            const unsigned index = tail & *sq_mask_;
+            struct io_uring_sqe& sqe = sqes_[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = opcode;
+            sqe.fd = fd_;
+            sqe.user_data = user_data;
+            if (opcode == IORING_OP_WRITE_FIXED) {
+                const job& j = jobs_[user_data / 2];
+                sqe.addr = reinterpret_cast<uint64_t>(j.data);
+                sqe.len = static_cast<uint32_t>(j.len);
+                sqe.off = j.offset;
+                sqe.buf_index = static_cast<uint16_t>(user_data / 2);
+            } else if (opcode == IORING_OP_FSYNC) {
+                sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+            }
+            sq_array_[index] = index;
+            __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+            for (;;) {
+                if (enter(ring_fd_, 1, 0, 0) >= 0) {
+                    return true;
+                }
+                if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    // Nothing was consumed, so take the entry back
+                    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+                    return false;
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        void run()
+        {
+            for (;;) {
+                const unsigned head = *cq_head_;
+                if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+                    const struct io_uring_cqe cqe = cqes_[head & *cq_mask_];
+                    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+                    complete(cqe.user_data, cqe.res);
+                    continue;
+                }
+                if (stop_.load()) {
+                    break;
+                }
+                // The ring is readable while completions are queued
+                struct pollfd fds[2] = { { ring_fd_, POLLIN, 0 }, { wake_fd_, POLLIN, 0 } };
+                if (::poll(fds, 2, -1) < 0 && errno != EINTR) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        }
+
+        void complete(uint64_t user_data, int res)
+        {
+            const size_t index = static_cast<size_t>(user_data / 2);
+            if (user_data % 2 == 1) {
+                done_(index, res >= 0);
+                return;
+            }
+            std::unique_lock<std::mutex> lock(mtx_);
+            job& j = jobs_[index];
+            bool ok = false;
+            if (res == -EINTR || res == -EAGAIN) {
+                if (push(IORING_OP_WRITE_FIXED, user_data)) {
+                    return;
+                }
+            } else if (res >= 0) {
+                j.data += res;
+                j.len -= static_cast<size_t>(res);
+                j.offset += static_cast<uint64_t>(res);
+                if (j.len > 0 && res > 0) {
+                    // Short write
+                    if (push(IORING_OP_WRITE_FIXED, user_data)) {
+                        return;
+                    }
+                } else if (j.len == 0 && sync_) {
+                    if (push(IORING_OP_FSYNC, user_data + 1)) {
+                        return;
+                    }
+                } else {
+                    ok = j.len == 0;
+                }
+            }
+            lock.unlock();
+            done_(index, ok);
+        }
+    };
+#endif
+} // namespace internal
+
+// Sink writing lines to a file without blocking the logging thread on disk I/O.
+// Lines are collected in a buffer which is handed to io_uring (with LOGU_ENABLE_IO_URING on Linux)
+// or to a pool of pwrite threads when full or according to the flush_policy, and the next buffer is filled meanwhile.
+// flush() waits until every buffer has been written.
+class async_file_sink : public logu::sink_base {
+public:
+    explicit async_file_sink(const char* filename, const logu::flush_policy& policy = logu::flush_policy(), const logu::async_io_policy& io = logu::async_io_policy())
+        : fd_(::open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+        , policy_(policy)
+        , backpressure_(io.backpressure())
+        , capacity_((policy.buffer_size() < 4096) ? 4096 : policy.buffer_size())
     {
-        options_[option_] = enable;
-        return *this;
+        std::vector<struct iovec> buffers(io.buffer_count());
+        submitted_.resize(io.buffer_count());
+        for (size_t i = 0; i < io.buffer_count(); ++i) {
+            buffers_.emplace_back(new char[capacity_]);
+            buffers[i].iov_base = buffers_[i].get();
+            buffers[i].iov_len = capacity_;
+            free_.push_back(io.buffer_count() - 1 - i);
+        }
+        if (fd_ < 0) {
+            return;
+        }
+        auto done = [this](size_t index, bool ok) { completed(index, ok); };
+#if defined(LOGU_INTERNAL_IO_URING)
+        if (io.io_uring()) {
+            backend_ = logu::internal::io_uring_backend::create(fd_, io.datasync(), buffers, done);
+        }
+#endif
+        if (!backend_) {
+            backend_.reset(new logu::internal::pwrite_backend(fd_, io.datasync(), io.threads(), done));
+        }
+        enable_emergency_flush();
     }
 
-    static constexpr const char* severity_to_str(logu::severity severity)
+    virtual ~async_file_sink()
     {
-        return (severity == logu::severity::debug) ? "DEBUG" :
-            (severity == logu::severity::info)     ? "INFO " :
-            (severity == logu::severity::warn)     ? "WARN " :
-            (severity == logu::severity::error)    ? "ERROR" :
-                                                     "-----";
+        disable_emergency_flush();
+        timer_.reset();
+        flush();
+        backend_.reset();
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+
+    // True if buffers are written through io_uring, false with the pwrite threads
+    bool uses_io_uring() const { return backend_ && backend_->is_io_uring(); }
+
+    // Number of buffers that failed to be written
+    uint64_t failed_writes() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return failed_;
+    }
+
+    // Number of lines dropped by the backpressure policy
+    uint64_t dropped_lines() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return dropped_total_;
+    }
+
+    void write(const logu::record& record, const char* str, size_t len) override
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        if (should_drop(record.severity(), len + 1)) {
+            ++dropped_;
+            ++dropped_total_;
+            return;
+        }
+        report_drops(lock, false);
+        append(lock, str, len);
+        append(lock, "\n", 1);
+        if (policy_.severity() <= record.severity()) {
+            submit_current();
+        } else if (policy_.interval().count() > 0 && policy_.interval() <= std::chrono::steady_clock::now() - last_flush_) {
+            submit_current();
+        } else if (policy_.interval().count() > 0 && !timer_) {
+            timer_.reset(new logu::internal::flush_timer(policy_.interval(), [this]() { flush_if_due(); }));
+        }
+    }
+
+    void flush() override
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        submit_current();
+        cv_.wait(lock, [this]() { return in_flight_ == 0; });
+        // Every buffer is free now, so the report always fits
+        if (dropped_ != 0) {
+            report_drops(lock, true);
+            submit_current();
+            cv_.wait(lock, [this]() { return in_flight_ == 0; });
+        }
+    }
+
+    // Buffers submitted but not completed yet are written again at their offsets, which is harmless
+    // if the backend got to them, then the buffer being filled
+    void emergency_flush() override
+    {
+        for (size_t i = 0; i < submitted_.size(); ++i) {
+            if (submitted_[i].pending) {
+                emergency_write(buffers_[i].get(), submitted_[i].size, submitted_[i].offset);
+            }
+        }
+        const size_t index = current_;
+        if (index < buffers_.size()) {
+            emergency_write(buffers_[index].get(), current_size_, offset_);
+        }
     }
 
 private:
-    std::unordered_map<option, bool> options_ = {
-        { option::datetime, true },
-        { option::datetime_year, true },
-        { option::datetime_microsecond, false },
-        { option::severity, true },
-        { option::threadid, true },
-        { option::file, true },
-        { option::func, false },
-        { option::line, true },
-        { option::tagname, true }
+    static constexpr size_t no_buffer = ~static_cast<size_t>(0);
+
+    const int fd_;
+    const logu::flush_policy policy_;
+    const logu::backpressure_policy backpressure_;
+    const size_t capacity_;
+    std::vector<std::unique_ptr<char[]>> buffers_;
+    std::vector<size_t> free_;
+    size_t current_ = no_buffer;
+    size_t current_size_ = 0;
+    uint64_t offset_ = 0;
+    size_t in_flight_ = 0;
+
+    // Where each buffer goes while the backend writes it, for emergency_flush
+    struct submission {
+        uint64_t offset = 0;
+        size_t size = 0;
+        bool pending = false;
     };
+    std::vector<submission> submitted_;
+    uint64_t failed_ = 0;
+    uint64_t dropped_ = 0; // Not reported yet
+    uint64_t dropped_total_ = 0;
+    std::chrono::steady_clock::time_point last_report_;
+    std::chrono::steady_clock::time_point last_flush_ = std::chrono::steady_clock::now();
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    std::unique_ptr<logu::internal::io_backend> backend_; // Must be destroyed before the buffers
+    std::unique_ptr<logu::internal::flush_timer> timer_;
 
-    void datetime(const logu::record& record, std::ostream& stream) const
+    void flush_if_due()
     {
-        const auto timet = std::chrono::system_clock::to_time_t(record.time());
-        struct tm localt = {};
-        internal::localtime_s(&localt, &timet);
-        char datetime_buf[20];
-        const char* datetime_fmt = options_.at(option::datetime_year) ? "%Y-%m-%d %H:%M:%S" : "%m-%d %H:%M:%S";
-        std::strftime(datetime_buf, sizeof(datetime_buf), datetime_fmt, &localt);
-        stream << datetime_buf;
-        if (options_.at(option::datetime_microsecond)) {
-            const auto usec = std::chrono::duration_cast<std::chrono::microseconds>(record.time().time_since_epoch()).count() % 1000000;
-            stream << "." << std::setw(6) << std::setfill('0') << usec << " | ";
-        } else {
-            const auto msec = std::chrono::duration_cast<std::chrono::milliseconds>(record.time().time_since_epoch()).count() % 1000;
-            stream << "." << std::setw(3) << std::setfill('0') << msec << " | ";
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (policy_.interval() <= std::chrono::steady_clock::now() - last_flush_) {
+            submit_current();
         }
     }
 
-    void severity(const logu::record& record, std::ostream& stream) const
+    // True if the line is to be dropped rather than wait for a buffer. Called with mtx_ held.
+    bool should_drop(logu::severity severity, size_t len) const
     {
-        stream << severity_to_str(record.severity()) << " | ";
+        if (backpressure_.get_overflow() == logu::backpressure_policy::overflow::block && severity >= backpressure_.drop_below()) {
+            return false;
+        }
+        return available() < len;
     }
 
-    void threadid(const logu::record& record, std::ostream& stream) const
+    // Bytes that can be written without waiting for a buffer. Called with mtx_ held.
+    size_t available() const
     {
-        stream << record.threadid() << " | ";
+        return ((current_ != no_buffer) ? capacity_ - current_size_ : 0) + free_.size() * capacity_;
     }
 
-    void file(const logu::record& record, std::ostream& stream) const
+    // Write "N records dropped" for the drops since the last report. Unless forced, only once per report interval
+    // and if it fits without waiting. Called with mtx_ held.
+    void report_drops(std::unique_lock<std::mutex>& lock, bool force)
     {
-        if (!logu::internal::is_null_or_empty(record.file())) {
-            if (options_.at(option::line)) {
-                stream << record.file() << "@" << record.line() << " | ";
-            } else {
-                stream << record.file() << " | ";
+        const auto now = std::chrono::steady_clock::now();
+        if (dropped_ == 0 || (!force && now - last_report_ < backpressure_.report_interval())) {
+            return;
+        }
+        const std::string line = std::to_string(dropped_) + " records dropped\n";
+        if (!force && available() < line.size()) {
+            return;
+        }
+        dropped_ = 0;
+        last_report_ = now;
+        append(lock, line.data(), line.size());
+    }
+
+    void append(std::unique_lock<std::mutex>& lock, const char* data, size_t len)
+    {
+        while (len > 0) {
+            if (current_ == no_buffer) {
+                // Wait only when every buffer is being written
+                cv_.wait(lock, [this]() { return !free_.empty(); });
+                current_ = free_.back();
+                free_.pop_back();
+                current_size_ = 0;
+            }
+            const size_t n = (len < capacity_ - current_size_) ? len : capacity_ - current_size_;
+            std::memcpy(buffers_[current_].get() + current_size_, data, n);
+            current_size_ += n;
+            data += n;
+            len -= n;
+            if (current_size_ == capacity_) {
+                submit_current();
             }
         }
     }
 
-    void func(const logu::record& record, std::ostream& stream) const
+    // Called with mtx_ held
+    void submit_current()
     {
-        if (!logu::internal::is_null_or_empty(record.func())) {
-            if (options_.at(option::line)) {
-                stream << record.func() << "@" << record.line() << " | ";
+        last_flush_ = std::chrono::steady_clock::now();
+        if (current_ == no_buffer) {
+            return;
+        }
+        const size_t index = current_;
+        current_ = no_buffer;
+        if (!backend_) {
+            free_.push_back(index);
+            return;
+        }
+        ++in_flight_;
+        submitted_[index].offset = offset_;
+        submitted_[index].size = current_size_;
+        submitted_[index].pending = true;
+        if (!backend_->submit(index, buffers_[index].get(), current_size_, offset_)) {
+            release(index, false);
+        }
+        offset_ += current_size_;
+    }
+
+    void emergency_write(const char* data, size_t len, uint64_t offset) const
+    {
+        while (len > 0) {
+            const ssize_t written = ::pwrite(fd_, data, len, static_cast<off_t>(offset));
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                break;
+            }
+            data += written;
+            len -= static_cast<size_t>(written);
+            offset += static_cast<uint64_t>(written);
+        }
+    }
+
+    // Called with mtx_ held
+    void release(size_t index, bool ok)
+    {
+        submitted_[index].pending = false;
+        free_.push_back(index);
+        --in_flight_;
+        if (!ok) {
+            ++failed_;
+        }
+    }
+
+    void completed(size_t index, bool ok)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            release(index, ok);
+        }
+        cv_.notify_all();
+    }
+};
+#endif
+
+namespace internal {
+    // Helpers for the binary log format, stored in little endian regardless of the platform
+    inline void append_le(std::string& out, uint64_t value, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i) {
+            out.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+        }
+    }
+
+    inline void append_binary_str(std::string& out, const char* str, size_t size_bytes, size_t max_len)
+    {
+        size_t len = (str != nullptr) ? std::char_traits<char>::length(str) : 0;
+        len = (len < max_len) ? len : max_len;
+        append_le(out, len, size_bytes);
+        out.append((str != nullptr) ? str : "", len);
+    }
+
+    constexpr const char* binary_magic = "LOGUBIN1";
+    constexpr size_t binary_magic_size = 8;
+} // namespace internal
+
+// Sink writing records in a compact binary format without formatting an output line.
+// The message is the text the statement built; the time, thread and fields are written as binary values.
+// The call site (severity, tag name, file, function and line) is written once as a descriptor,
+// and each record carries only the descriptor id, time, thread, message and fields.
+// Use logu::binary_reader or the logu_decode tool to turn the file back into text.
+//
+// Format (little endian):
+//   "LOGUBIN1"
+//   'D' id:u32 severity:u8 line:u32 file:str16 func:str16 tagname:str16
+//   'S' suppressed:u64 (before an R record whose logu::record::suppressed() is not zero)
+//   'R' id:u32 time_ns:i64 threadid:u64 threadname:str8 message:str32 field_count:u16 field...
+// field is type:u8 key:str16 followed by the value as in logu::field::type:
+//   signed_integer:i64 unsigned_integer:u64 floating:f64 boolean:u8 string:str32
+// strN is a length of N bits followed by the characters.
+class binary_sink : public logu::file_sink {
+public:
+    explicit binary_sink(const char* filename, const logu::flush_policy& policy = logu::flush_policy())
+        : logu::file_sink(filename, "wb", policy)
+    {
+    }
+
+    virtual ~binary_sink()
+    {
+        disable_emergency_flush();
+        stop_flush_timer();
+        flush();
+    }
+
+    bool needs_text() const override { return false; }
+
+protected:
+    void encode(const logu::record& record, const char* str, size_t len, std::string& buffer) override
+    {
+        (void)str;
+        (void)len;
+        if (!header_written_) {
+            buffer.append(logu::internal::binary_magic, logu::internal::binary_magic_size);
+            header_written_ = true;
+        }
+        const uint32_t id = descriptor_id(record, buffer);
+        const auto message = record.message_view();
+        const auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(record.time().time_since_epoch()).count();
+        if (record.suppressed() != 0) {
+            buffer.push_back('S');
+            logu::internal::append_le(buffer, record.suppressed(), 8);
+        }
+        buffer.push_back('R');
+        logu::internal::append_le(buffer, id, 4);
+        logu::internal::append_le(buffer, static_cast<uint64_t>(time), 8);
+        logu::internal::append_le(buffer, record.threadid(), 8);
+        logu::internal::append_binary_str(buffer, record.threadname(), 1, 0xFF);
+        logu::internal::append_le(buffer, message.size(), 4);
+        buffer.append(message.data(), message.size());
+        append_fields(record, buffer);
+    }
+
+private:
+    // Records made by the logging macros are identified by the address of their call site.
+    // Other records are compared by content since their strings may be temporary
+    // and their addresses reused by another call site.
+    struct call_site {
+        std::string file;
+        std::string func;
+        std::string tagname;
+        size_t line;
+        logu::severity severity;
+        uint32_t id;
+    };
+
+    bool header_written_ = false;
+    uint32_t next_id_ = 0;
+    std::unordered_map<const logu::source_location*, uint32_t> static_ids_;
+    std::unordered_multimap<uint32_t, call_site> descriptors_; // Keyed by the hash of the strings
+
+    static bool same_str(const std::string& lhs, const char* rhs)
+    {
+        return lhs == ((rhs != nullptr) ? rhs : "");
+    }
+
+    static uint32_t str_hash(const char* str)
+    {
+        return (str != nullptr) ? logu::internal::murmur3::murmur3_runtime(str, std::char_traits<char>::length(str)) : 0;
+    }
+
+    // Return the descriptor id of the record's call site, writing the descriptor the first time
+    uint32_t descriptor_id(const logu::record& record, std::string& buffer)
+    {
+        if (const logu::source_location* location = record.static_location()) {
+            const auto itr = static_ids_.find(location);
+            if (itr != static_ids_.end()) {
+                return itr->second;
+            }
+            const uint32_t id = next_id_++;
+            static_ids_.insert(std::make_pair(location, id));
+            write_descriptor(id, record, buffer);
+            return id;
+        }
+        const uint32_t hash = str_hash(record.file()) ^ (str_hash(record.func()) * 31) ^ (str_hash(record.tagname()) * 961)
+            ^ static_cast<uint32_t>(record.line() << 8) ^ static_cast<uint32_t>(record.severity());
+        const auto range = descriptors_.equal_range(hash);
+        for (auto itr = range.first; itr != range.second; ++itr) {
+            const call_site& site = itr->second;
+            if (site.line == record.line() && site.severity == record.severity() && same_str(site.file, record.file())
+                && same_str(site.func, record.func()) && same_str(site.tagname, record.tagname())) {
+                return site.id;
+            }
+        }
+        const call_site site = { (record.file() != nullptr) ? record.file() : "", (record.func() != nullptr) ? record.func() : "",
+            (record.tagname() != nullptr) ? record.tagname() : "", record.line(), record.severity(), next_id_++ };
+        descriptors_.insert(std::make_pair(hash, site));
+        write_descriptor(site.id, record, buffer);
+        return site.id;
+    }
+
+    static void write_descriptor(uint32_t id, const logu::record& record, std::string& buffer)
+    {
+        buffer.push_back('D');
+        logu::internal::append_le(buffer, id, 4);
+        logu::internal::append_le(buffer, static_cast<uint64_t>(record.severity()), 1);
+        logu::internal::append_le(buffer, record.line(), 4);
+        logu::internal::append_binary_str(buffer, record.file(), 2, 0xFFFF);
+        logu::internal::append_binary_str(buffer, record.func(), 2, 0xFFFF);
+        logu::internal::append_binary_str(buffer, record.tagname(), 2, 0xFFFF);
+    }
+
+    static void append_fields(const logu::record& record, std::string& buffer)
+    {
+        const size_t count_pos = buffer.size();
+        size_t count = 0;
+        logu::internal::append_le(buffer, 0, 2);
+        record.for_each_field([&](const logu::field& f) {
+            if (count == 0xFFFF) {
+                return;
+            }
+            ++count;
+            buffer.push_back(static_cast<char>(f.value_type));
+            const size_t key_len = (f.key.size() < 0xFFFF) ? f.key.size() : 0xFFFF;
+            logu::internal::append_le(buffer, key_len, 2);
+            buffer.append(f.key.data(), key_len);
+            switch (f.value_type) {
+            case logu::field::type::signed_integer:
+                logu::internal::append_le(buffer, static_cast<uint64_t>(f.i), 8);
+                break;
+            case logu::field::type::unsigned_integer:
+                logu::internal::append_le(buffer, f.u, 8);
+                break;
+            case logu::field::type::floating: {
+                uint64_t bits;
+                std::memcpy(&bits, &f.d, sizeof(bits));
+                logu::internal::append_le(buffer, bits, 8);
+                break;
+            }
+            case logu::field::type::boolean:
+                buffer.push_back(f.b ? '\1' : '\0');
+                break;
+            case logu::field::type::string:
+                logu::internal::append_le(buffer, f.str.size(), 4);
+                buffer.append(f.str.data(), f.str.size());
+                break;
+            }
+        });
+        buffer[count_pos] = static_cast<char>(count & 0xFF);
+        buffer[count_pos + 1] = static_cast<char>(count >> 8);
+    }
+};
+
+// Read records written by logu::binary_sink
+class binary_reader : logu::internal::noncopyable {
+public:
+    explicit binary_reader(const char* filename)
+        : file_(std::fopen(filename, "rb"))
+    {
+        char magic[logu::internal::binary_magic_size];
+        valid_ = file_ != nullptr && read_bytes(magic, sizeof(magic))
+            && std::char_traits<char>::compare(magic, logu::internal::binary_magic, sizeof(magic)) == 0;
+    }
+
+    ~binary_reader()
+    {
+        if (file_ != nullptr) {
+            std::fclose(file_);
+        }
+    }
+
+    // False if the file could not be opened or is not a binary log
+    bool is_valid() const { return valid_; }
+
+    // Call func with the next record. Returns false at the end of the file or on broken data.
+    bool read_next(const std::function<void(const logu::record&)>& func)
+    {
+        while (valid_) {
+            const int type = std::fgetc(file_);
+            if (type == 'D') {
+                descriptor d;
+                uint64_t id, severity, line;
+                if (!read_le(id, 4) || !read_le(severity, 1) || !read_le(line, 4)
+                    || !read_str(d.file, 2) || !read_str(d.func, 2) || !read_str(d.tagname, 2)) {
+                    break;
+                }
+                d.severity = static_cast<logu::severity>(severity);
+                d.line = static_cast<size_t>(line);
+                if (descriptors_.size() <= id) {
+                    descriptors_.resize(static_cast<size_t>(id) + 1);
+                }
+                descriptors_[static_cast<size_t>(id)] = d;
+            } else if (type == 'S') {
+                if (!read_le(suppressed_, 8)) {
+                    break;
+                }
+            } else if (type == 'R') {
+                uint64_t id, time, threadid, size;
+                std::string threadname;
+                if (!read_le(id, 4) || !read_le(time, 8) || !read_le(threadid, 8) || !read_str(threadname, 1)
+                    || !read_le(size, 4) || descriptors_.size() <= id) {
+                    break;
+                }
+                message_.resize(static_cast<size_t>(size));
+                if (size != 0 && !read_bytes(&message_[0], message_.size())) {
+                    break;
+                }
+                const descriptor& d = descriptors_[static_cast<size_t>(id)];
+                const auto since_epoch = std::chrono::nanoseconds(static_cast<int64_t>(time));
+                logu::record record(d.severity, d.tagname.c_str(), d.file.c_str(), d.func.c_str(), d.line, threadid, threadname.c_str(),
+                    std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(since_epoch)));
+                record << logu::string_view(message_.data(), message_.size());
+                record.set_suppressed(suppressed_);
+                suppressed_ = 0;
+                if (!read_fields(record)) {
+                    break;
+                }
+                func(record);
+                return true;
             } else {
-                stream << record.func() << " | ";
+                break;
+            }
+        }
+        valid_ = false;
+        return false;
+    }
+
+private:
+    struct descriptor {
+        logu::severity severity = logu::severity::none;
+        size_t line = 0;
+        std::string file;
+        std::string func;
+        std::string tagname;
+    };
+
+    std::FILE* file_;
+    bool valid_ = false;
+    std::vector<descriptor> descriptors_;
+    std::string message_;
+    uint64_t suppressed_ = 0; // From an S record, for the next record
+
+    bool read_bytes(char* buf, size_t size)
+    {
+        return std::fread(buf, 1, size, file_) == size;
+    }
+
+    bool read_le(uint64_t& value, size_t size)
+    {
+        unsigned char buf[8];
+        if (!read_bytes(reinterpret_cast<char*>(buf), size)) {
+            return false;
+        }
+        value = 0;
+        for (size_t i = 0; i < size; ++i) {
+            value |= static_cast<uint64_t>(buf[i]) << (i * 8);
+        }
+        return true;
+    }
+
+    bool read_str(std::string& str, size_t size_bytes)
+    {
+        uint64_t len;
+        if (!read_le(len, size_bytes)) {
+            return false;
+        }
+        str.resize(static_cast<size_t>(len));
+        return len == 0 || read_bytes(&str[0], str.size());
+    }
+
+    bool read_fields(logu::record& record)
+    {
+        uint64_t count;
+        if (!read_le(count, 2)) {
+            return false;
+        }
+        std::string key, str;
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t type, value;
+            if (!read_le(type, 1) || !read_str(key, 2)) {
+                return false;
+            }
+            switch (static_cast<logu::field::type>(type)) {
+            case logu::field::type::signed_integer:
+                if (!read_le(value, 8)) {
+                    return false;
+                }
+                record.kv(key, static_cast<int64_t>(value));
+                break;
+            case logu::field::type::unsigned_integer:
+                if (!read_le(value, 8)) {
+                    return false;
+                }
+                record.kv(key, value);
+                break;
+            case logu::field::type::floating: {
+                double d;
+                if (!read_le(value, 8)) {
+                    return false;
+                }
+                std::memcpy(&d, &value, sizeof(d));
+                record.kv(key, d);
+                break;
+            }
+            case logu::field::type::boolean:
+                if (!read_le(value, 1)) {
+                    return false;
+                }
+                record.kv(key, value != 0);
+                break;
+            case logu::field::type::string:
+                if (!read_str(str, 4)) {
+                    return false;
+                }
+                record.kv(key, str);
+                break;
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+namespace internal {
+    // Background thread that drains records pushed by logging threads
+    class async_worker : logu::internal::noncopyable {
+    public:
+        using functype_consume = std::function<void(logu::record&)>;
+
+        async_worker(size_t capacity, const logu::backpressure_policy& policy, const char* tagname, functype_consume consume)
+            : queue_(capacity)
+            , policy_(policy)
+            , tagname_(tagname)
+            , consume_(consume)
+            , thread_([this]() { run(); })
+        {
+        }
+
+        ~async_worker()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                stop_ = true;
+            }
+            wakeup_cv_.notify_one();
+            thread_.join();
+        }
+
+        void push(logu::record&& record)
+        {
+            const size_t bytes = record_bytes(record);
+            for (;;) {
+                const uint64_t consumed = consumed_.load(std::memory_order_seq_cst);
+                if (reserve(bytes)) {
+                    if (queue_.try_push(std::move(record))) {
+                        break;
+                    }
+                    release(bytes);
+                }
+                if (record.severity() < policy_.drop_below() || policy_.get_overflow() == logu::backpressure_policy::overflow::drop_newest) {
+                    count_drop();
+                    return;
+                }
+                if (policy_.get_overflow() == logu::backpressure_policy::overflow::drop_oldest) {
+                    // Consumed without output, so flush() does not wait for it.
+                    // If the queue is empty again by now, the new record is dropped instead.
+                    count_drop();
+                    if (!queue_.try_consume([this](logu::record& oldest) { release(record_bytes(oldest)); })) {
+                        return;
+                    }
+                    consumed_.fetch_add(1, std::memory_order_release);
+                    continue;
+                }
+                wait_for_room(consumed);
+            }
+            pushed_.fetch_add(1, std::memory_order_seq_cst);
+            if (sleeping_.load(std::memory_order_seq_cst)) {
+                std::lock_guard<std::mutex> lock(mtx_);
+                wakeup_cv_.notify_one();
+            }
+        }
+
+        // Wait until every record pushed before this call has been consumed
+        void flush()
+        {
+            if (std::this_thread::get_id() == thread_.get_id()) {
+                return;
+            }
+            const uint64_t target = pushed_.load(std::memory_order_relaxed);
+            std::unique_lock<std::mutex> lock(mtx_);
+            while (consumed_.load(std::memory_order_acquire) < target) {
+                idle_cv_.wait_for(lock, std::chrono::milliseconds(10));
+            }
+            lock.unlock();
+            report_drops(true);
+        }
+
+        // Records dropped by the backpressure policy since creation or reset_dropped()
+        uint64_t dropped() const { return dropped_total_.load(std::memory_order_relaxed); }
+        void reset_dropped() { dropped_total_.store(0, std::memory_order_relaxed); }
+
+    private:
+        logu::internal::bounded_queue<logu::record> queue_;
+        const logu::backpressure_policy policy_;
+        const char* const tagname_;
+        functype_consume consume_;
+        std::atomic<uint64_t> pushed_ { 0 };
+        std::atomic<uint64_t> consumed_ { 0 };
+        std::atomic<size_t> queued_bytes_ { 0 };
+        std::atomic<uint64_t> dropped_ { 0 }; // Not reported yet
+        std::atomic<uint64_t> dropped_total_ { 0 };
+        std::chrono::steady_clock::time_point last_report_;
+        std::mutex report_mtx_;
+        std::atomic<bool> sleeping_ { false };
+        std::atomic<int> blocked_ { 0 }; // Producers waiting in wait_for_room
+        bool stop_ = false;
+        std::mutex mtx_;
+        std::condition_variable wakeup_cv_;
+        std::condition_variable idle_cv_;
+        std::condition_variable room_cv_;
+        std::thread thread_;
+
+        // Approximate memory held by a queued record
+        static size_t record_bytes(const logu::record& record)
+        {
+            return sizeof(logu::record) + record.message_view().size();
+        }
+
+        // Account the bytes of a record about to be queued, unless they exceed the budget.
+        // A record always fits into an empty queue.
+        bool reserve(size_t bytes)
+        {
+            if (policy_.max_bytes() == 0) {
+                return true;
+            }
+            size_t queued = queued_bytes_.load(std::memory_order_relaxed);
+            do {
+                if (queued != 0 && policy_.max_bytes() < queued + bytes) {
+                    return false;
+                }
+            } while (!queued_bytes_.compare_exchange_weak(queued, queued + bytes, std::memory_order_relaxed));
+            return true;
+        }
+
+        void release(size_t bytes)
+        {
+            if (policy_.max_bytes() > 0) {
+                queued_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+            }
+        }
+
+        // Sleep until the worker has consumed a record since consumed was read
+        void wait_for_room(uint64_t consumed)
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            blocked_.fetch_add(1, std::memory_order_seq_cst);
+            room_cv_.wait(lock, [this, consumed]() { return consumed_.load(std::memory_order_seq_cst) != consumed; });
+            blocked_.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        void count_drop()
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            dropped_total_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Output "N records dropped" for the drops since the last report
+        void report_drops(bool force)
+        {
+            if (dropped_.load(std::memory_order_relaxed) == 0) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(report_mtx_);
+            const auto now = std::chrono::steady_clock::now();
+            if (!force && now - last_report_ < policy_.report_interval()) {
+                return;
+            }
+            const uint64_t count = dropped_.exchange(0, std::memory_order_relaxed);
+            if (count != 0) {
+                last_report_ = now;
+                logu::record record(logu::severity::warn, tagname_, "", "", 0);
+                record << count << " records dropped";
+                consume_(record);
+            }
+        }
+
+        void run()
+        {
+            // Move each record out of the queue before output, so that its slot is free meanwhile
+            // and a drop_oldest producer can always make room
+            std::aligned_storage<sizeof(logu::record), alignof(logu::record)>::type storage;
+            logu::record* const taken = reinterpret_cast<logu::record*>(&storage);
+            const auto take = [taken](logu::record& record) { new (taken) logu::record(std::move(record)); };
+            for (;;) {
+                if (queue_.try_consume(take)) {
+                    const size_t bytes = record_bytes(*taken);
+                    consume_(*taken);
+                    taken->~record();
+                    release(bytes);
+                    consumed_.fetch_add(1, std::memory_order_seq_cst);
+                    if (blocked_.load(std::memory_order_seq_cst) != 0) {
+                        std::lock_guard<std::mutex> lock(mtx_);
+                        room_cv_.notify_all();
+                    }
+                    report_drops(false);
+                    continue;
+                }
+                report_drops(false);
+                std::unique_lock<std::mutex> lock(mtx_);
+                idle_cv_.notify_all();
+                sleeping_.store(true, std::memory_order_seq_cst);
+                if (pushed_.load(std::memory_order_seq_cst) == consumed_.load(std::memory_order_relaxed)) {
+                    if (stop_) {
+                        break;
+                    }
+                    wakeup_cv_.wait_for(lock, std::chrono::milliseconds(100));
+                }
+                sleeping_.store(false, std::memory_order_relaxed);
             }
         }
-    }
+    };
+} // namespace internal
 
-    void tagname(const logu::record& record, std::ostream& stream) const
-    {
-        if (!logu::internal::is_null_or_empty(record.tagname())) {
-            stream << "[" << record.tagname() << "] ";
-        }
-    }
+// Snapshot of the counters of a logger (see logger::set_stats)
+struct logger_stats {
+    struct handler_stats {
+        uint64_t bytes = 0; // Text passed to the handler
+        uint64_t nanoseconds = 0; // Time spent in the handler
+    };
+
+    uint64_t accepted = 0; // Records passing the severity and enable check
+    uint64_t filtered = 0; // Records rejected by the severity and enable check
+    uint64_t bytes_formatted = 0;
+    uint64_t format_nanoseconds = 0; // Time spent in the formatter
+    uint64_t lock_wait_nanoseconds = 0; // Time spent waiting for the logger mutex
+    uint64_t dropped = 0; // Records dropped by the backpressure policy of the async queue
+    std::vector<handler_stats> handlers; // In the order of set_handler
 };
 
 class logger : logu::internal::noncopyable {
@@ -491,11 +4485,17 @@ public:
         , tagname_(tagname)
     {
         if (parent != nullptr) {
+            // Severity, enable, handlers and formatter are inherited until set on this logger
+            std::lock_guard<std::mutex> parent_lock(parent->mtx_);
             handlers_ = parent->handlers_;
             formatter_ = parent->formatter_;
-            min_severity_ptr_ = parent->min_severity_ptr_;
-            max_severity_ptr_ = parent->max_severity_ptr_;
-            enable_logging_ptr_ = parent->enable_logging_ptr_;
+            own_severity_ = false;
+            own_enable_ = false;
+            own_handlers_ = false;
+            own_formatter_ = false;
+            // Statistics are per logger and not inherited
+            filter_.store(parent->filter_.load(std::memory_order_relaxed) & ~filter_stats_bit, std::memory_order_relaxed);
+            parent->children_.push_back(this);
         } else {
 #if defined(LOGU_ENABLE_PLATFORM_LOGGER_WINDOWS) || defined(LOGU_ENABLE_PLATFORM_LOGGER_ANDROID) || defined(LOGU_ENABLE_PLATFORM_LOGGER_LINUX)
             void platform_logger(const logu::record& record, const char* str);
@@ -508,33 +4508,82 @@ public:
 
     logger() = delete;
 
+    ~logger()
+    {
+        // Drain the queue, then output the records still held back as repeats
+        async_worker_.store(nullptr, std::memory_order_release);
+        async_worker_owner_.reset();
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            output_repeat();
+        }
+        if (parent_ != nullptr) {
+            std::lock_guard<std::mutex> parent_lock(parent_->mtx_);
+            auto& siblings = parent_->children_;
+            siblings.erase(std::remove(siblings.begin(), siblings.end(), this), siblings.end());
+        }
+    }
+
     void operator+=(const logu::record& record)
     {
+        const bool stats = stats_enabled();
+        const auto lock_start = stats ? stats_clock::now() : stats_clock::time_point();
         std::lock_guard<std::mutex> lock(mtx_);
-        if (formatter_) {
-            const auto str = formatter_->format(record);
-            for (auto& h : handlers_) {
-                h->output(record, str.c_str());
-            }
+        if (stats) {
+            counters_.lock_wait_nanoseconds.fetch_add(elapsed_nanoseconds(lock_start), std::memory_order_relaxed);
+        }
+        if (repeat_window_.count() > 0 && suppress_repeat(record)) {
+            return;
+        }
+        output(record);
+    }
+
+    void operator+=(logu::record&& record)
+    {
+        internal::async_worker* worker = async_worker_.load(std::memory_order_acquire);
+        if (worker != nullptr) {
+            worker->push(std::move(record));
+        } else {
+            *this += static_cast<const logu::record&>(record);
         }
     }
 
     bool should_output(logu::severity severity) const
     {
-        return *enable_logging_ptr_ && (*min_severity_ptr_ <= severity) && (severity <= *max_severity_ptr_);
+        const uint32_t filter = filter_.load(std::memory_order_relaxed);
+        const bool output = ((filter & filter_enable_bit) != 0) && (filter_min_severity(filter) <= severity) && (severity <= filter_max_severity(filter));
+        if ((filter & filter_stats_bit) != 0) {
+            (output ? counters_.accepted : counters_.filtered).fetch_add(1, std::memory_order_relaxed);
+        }
+        return output;
     }
 
+    // Copies the current settings of rhs. Severity and enable become settings of this logger.
     logger& copy_from(const logu::logger& rhs)
     {
+        if (&rhs == this) {
+            return *this;
+        }
+        std::shared_ptr<logu::formatter_base> formatter;
+        std::vector<std::shared_ptr<handler>> handlers;
+        {
+            std::lock_guard<std::mutex> rhs_lock(rhs.mtx_);
+            handlers = rhs.handlers_;
+            formatter = rhs.formatter_;
+        }
+        const uint32_t filter = rhs.filter_.load(std::memory_order_relaxed);
         std::lock_guard<std::mutex> lock(mtx_);
-        handlers_ = rhs.handlers_;
-        formatter_ = rhs.formatter_;
-        min_severity_ = rhs.min_severity_;
-        max_severity_ = rhs.max_severity_;
-        min_severity_ptr_ = rhs.min_severity_ptr_;
-        max_severity_ptr_ = rhs.max_severity_ptr_;
-        enable_logging_ = rhs.enable_logging_;
-        enable_logging_ptr_ = rhs.enable_logging_ptr_;
+        handlers_ = std::move(handlers);
+        handler_stats_.clear();
+        formatter_ = std::move(formatter);
+        min_severity_ = filter_min_severity(filter);
+        max_severity_ = filter_max_severity(filter);
+        enable_logging_ = (filter & filter_enable_bit) != 0;
+        own_severity_ = true;
+        own_enable_ = true;
+        own_handlers_ = true;
+        own_formatter_ = true;
+        update_effective();
         return *this;
     }
 
@@ -543,15 +4592,35 @@ public:
     {
         std::lock_guard<std::mutex> lock(mtx_);
         handlers_.clear();
+        handler_stats_.clear();
         set_handler_internal(std::forward<Args>(args)...);
+        own_handlers_ = true;
+        update_effective();
         return *this;
     }
 
+    // Add a handler receiving only the records of min_severity or above
+    template <typename HandlerType>
+    logger& add_handler(HandlerType&& target, logu::severity min_severity = logu::severity::debug)
+    {
+        return add_handler_internal(std::make_shared<handler>(target), nullptr, min_severity);
+    }
+
+    // Add a handler with its own formatter instead of the one of the logger
+    template <typename HandlerType, typename FormatterType,
+        typename std::enable_if<std::is_base_of<logu::formatter_base, FormatterType>::value, int>::type = 0>
+    logger& add_handler(HandlerType&& target, const FormatterType& formatter, logu::severity min_severity = logu::severity::debug)
+    {
+        return add_handler_internal(std::make_shared<handler>(target), std::make_shared<FormatterType>(formatter), min_severity);
+    }
+
     template <typename FormatterType>
     logger& set_formatter(const FormatterType& formatter)
     {
         std::lock_guard<std::mutex> lock(mtx_);
         formatter_ = std::unique_ptr<logu::formatter_base>(new FormatterType(formatter));
+        own_formatter_ = true;
+        update_effective();
         return *this;
     }
 
@@ -560,15 +4629,109 @@ public:
         std::lock_guard<std::mutex> lock(mtx_);
         min_severity_ = min_severity;
         max_severity_ = max_severity;
-        min_severity_ptr_ = &min_severity_;
-        max_severity_ptr_ = &max_severity_;
+        own_severity_ = true;
+        update_effective();
         return *this;
     }
 
     logger& set_enable(bool enable)
     {
+        std::lock_guard<std::mutex> lock(mtx_);
         enable_logging_ = enable;
-        enable_logging_ptr_ = &enable_logging_;
+        own_enable_ = true;
+        update_effective();
+        return *this;
+    }
+
+    // Count records and measure the time spent in this logger. Off by default, as timing costs a clock read per step.
+    logger& set_stats(bool enable)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stats_enabled_ = enable;
+        update_effective();
+        return *this;
+    }
+
+    logu::logger_stats stats() const
+    {
+        logu::logger_stats stats;
+        stats.accepted = counters_.accepted.load(std::memory_order_relaxed);
+        stats.filtered = counters_.filtered.load(std::memory_order_relaxed);
+        stats.bytes_formatted = counters_.bytes_formatted.load(std::memory_order_relaxed);
+        stats.format_nanoseconds = counters_.format_nanoseconds.load(std::memory_order_relaxed);
+        stats.lock_wait_nanoseconds = counters_.lock_wait_nanoseconds.load(std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> async_lock(async_mtx_);
+            stats.dropped = async_worker_owner_ ? async_worker_owner_->dropped() : 0;
+        }
+        std::lock_guard<std::mutex> lock(mtx_);
+        stats.handlers = handler_stats_;
+        stats.handlers.resize(handlers_.size());
+        return stats;
+    }
+
+    logger& reset_stats()
+    {
+        {
+            std::lock_guard<std::mutex> async_lock(async_mtx_);
+            if (async_worker_owner_) {
+                async_worker_owner_->reset_dropped();
+            }
+        }
+        std::lock_guard<std::mutex> lock(mtx_);
+        counters_.accepted.store(0, std::memory_order_relaxed);
+        counters_.filtered.store(0, std::memory_order_relaxed);
+        counters_.bytes_formatted.store(0, std::memory_order_relaxed);
+        counters_.format_nanoseconds.store(0, std::memory_order_relaxed);
+        counters_.lock_wait_nanoseconds.store(0, std::memory_order_relaxed);
+        handler_stats_.clear();
+        return *this;
+    }
+
+    // Format and output records on a background thread.
+    // The worker is kept alive once created so that concurrent callers never see it destroyed,
+    // and the queue capacity and backpressure policy given when it is created stay in effect.
+    logger& set_async(bool enable, size_t queue_capacity = 4096, const logu::backpressure_policy& policy = logu::backpressure_policy())
+    {
+        std::lock_guard<std::mutex> lock(async_mtx_);
+        if (enable && !async_worker_owner_) {
+            async_worker_owner_ = std::unique_ptr<internal::async_worker>(new internal::async_worker(
+                queue_capacity, policy, tagname_.c_str(), [this](logu::record& record) { *this += static_cast<const logu::record&>(record); }));
+        }
+        async_worker_.store(enable ? async_worker_owner_.get() : nullptr, std::memory_order_release);
+        if (!enable && async_worker_owner_) {
+            async_worker_owner_->flush();
+        }
+        return *this;
+    }
+
+    bool is_async() const { return async_worker_.load(std::memory_order_relaxed) != nullptr; }
+
+    // Hold back records repeating the last output one (same file, line, severity and message) within the window
+    // and output "last message repeated N times" when another record or a repeat past the window arrives,
+    // on flush() and when the logger is destroyed. No timer fires on its own. Zero disables it.
+    template <typename Rep, typename Period>
+    logger& set_repeat_suppression(std::chrono::duration<Rep, Period> window)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        output_repeat();
+        repeat_ = repeat_state();
+        repeat_window_ = std::chrono::duration_cast<std::chrono::system_clock::duration>(window);
+        return *this;
+    }
+
+    // Wait until all queued records have been passed to the handlers, then flush the handlers
+    logger& flush()
+    {
+        internal::async_worker* worker = async_worker_.load(std::memory_order_acquire);
+        if (worker != nullptr) {
+            worker->flush();
+        }
+        std::lock_guard<std::mutex> lock(mtx_);
+        output_repeat();
+        for (auto& h : handlers_) {
+            h->flush();
+        }
         return *this;
     }
 
@@ -586,6 +4749,7 @@ private:
         handler(functype_record func) : output_func_record_(func) { }
         handler(functype_record_str func) : output_func_record_str_(func) { }
         handler(std::ostream& stream) : output_stream_(stream) { }
+        handler(std::shared_ptr<logu::sink_base> sink) : output_sink_(sink) { }
         // clang-format on
 
         handler(const char* filename)
@@ -594,9 +4758,11 @@ private:
         {
         }
 
-        void output(const logu::record& record, const char* str)
+        void output(const logu::record& record, const char* str, size_t len)
         {
-            if (output_func_str_ != nullptr) {
+            if (output_sink_ != nullptr) {
+                output_sink_->write(record, str, len);
+            } else if (output_func_str_ != nullptr) {
                 output_func_str_(str);
             } else if (output_func_record_ != nullptr) {
                 output_func_record_(record);
@@ -607,12 +4773,36 @@ private:
             }
         }
 
+        bool needs_text() const
+        {
+            return (output_sink_ != nullptr) ? output_sink_->needs_text() : (output_func_record_ == nullptr);
+        }
+
+        // Formatter of this handler, or nullptr to use the one of the logger
+        logu::formatter_base* formatter() const { return formatter_.get(); }
+        void set_formatter(std::shared_ptr<logu::formatter_base> formatter) { formatter_ = std::move(formatter); }
+
+        logu::severity min_severity() const { return min_severity_; }
+        void set_min_severity(logu::severity min_severity) { min_severity_ = min_severity; }
+
+        void flush()
+        {
+            if (output_sink_ != nullptr) {
+                output_sink_->flush();
+            } else if (output_func_str_ == nullptr && output_func_record_ == nullptr && output_func_record_str_ == nullptr) {
+                output_stream_.get().flush();
+            }
+        }
+
     private:
+        std::shared_ptr<logu::sink_base> output_sink_;
         std::shared_ptr<std::ofstream> output_filestream_;
         std::reference_wrapper<std::ostream> output_stream_ = std::ref(std::cout);
         functype_str output_func_str_;
         functype_record output_func_record_;
         functype_record_str output_func_record_str_;
+        std::shared_ptr<logu::formatter_base> formatter_;
+        logu::severity min_severity_ = logu::severity::debug;
     };
 
 private:
@@ -620,13 +4810,61 @@ private:
     std::string tagname_;
     std::vector<std::shared_ptr<handler>> handlers_;
     std::shared_ptr<logu::formatter_base> formatter_ = std::make_shared<logu::formatter>();
+    logu::format_buffer format_buffer_;
+
+    // Last output record for the repeat suppression (guarded by mtx_)
+    struct repeat_state {
+        bool valid = false;
+        const logu::source_location* site = nullptr; // Of a record made by the logging macros
+        // Copied from a record made from fields, whose strings may not outlive it
+        logu::severity severity = logu::severity::none;
+        std::string tagname;
+        std::string file;
+        std::string func;
+        size_t line = 0;
+        size_t message_size = 0;
+        uint32_t message_hash = 0;
+        std::chrono::system_clock::time_point output_time;
+        uint64_t count = 0; // Records held back
+        uint64_t threadid = 0; // Of the last record held back
+        char threadname[logu::internal::threadname_size] = {};
+        std::chrono::system_clock::time_point time;
+    };
+    repeat_state repeat_;
+    std::chrono::system_clock::duration repeat_window_ { 0 };
+
+    // Filter word read by should_output(): minimum severity, maximum severity, the enable bit and the stats bit
+    static constexpr uint32_t filter_enable_bit = 1u << 16;
+    static constexpr uint32_t filter_stats_bit = 1u << 17;
+    std::atomic<uint32_t> filter_ { make_filter(logu::severity::debug, logu::severity::none, true) };
+
+    // Settings of this logger, used instead of the parent's ones when own_* is set (guarded by mtx_).
+    // handlers_ and formatter_ hold the parent's ones while inherited.
     logu::severity min_severity_ = logu::severity::debug;
     logu::severity max_severity_ = logu::severity::none;
-    logu::severity* min_severity_ptr_ = &min_severity_;
-    logu::severity* max_severity_ptr_ = &max_severity_;
     bool enable_logging_ = true;
-    bool* enable_logging_ptr_ = &enable_logging_;
-    std::mutex mtx_;
+    bool own_severity_ = true;
+    bool own_enable_ = true;
+    bool own_handlers_ = true;
+    bool own_formatter_ = true;
+    bool stats_enabled_ = false; // Not inherited
+    std::vector<logger*> children_;
+
+    // Counters updated with relaxed atomics, as should_output() runs on the calling threads without the lock
+    using stats_clock = std::chrono::steady_clock;
+    struct counters {
+        std::atomic<uint64_t> accepted { 0 };
+        std::atomic<uint64_t> filtered { 0 };
+        std::atomic<uint64_t> bytes_formatted { 0 };
+        std::atomic<uint64_t> format_nanoseconds { 0 };
+        std::atomic<uint64_t> lock_wait_nanoseconds { 0 };
+    };
+    mutable counters counters_;
+    std::vector<logu::logger_stats::handler_stats> handler_stats_; // Guarded by mtx_
+    mutable std::mutex mtx_;
+    mutable std::mutex async_mtx_;
+    std::atomic<internal::async_worker*> async_worker_ { nullptr };
+    std::unique_ptr<internal::async_worker> async_worker_owner_; // Must be destroyed first to drain the queue
 
     template <typename First, typename... Args>
     void set_handler_internal(First&& first, Args&&... args)
@@ -642,80 +4880,536 @@ private:
     }
 
     void set_handler_internal() { }
+
+    logger& add_handler_internal(std::shared_ptr<handler> h, std::shared_ptr<logu::formatter_base> formatter, logu::severity min_severity)
+    {
+        h->set_formatter(std::move(formatter));
+        h->set_min_severity(min_severity);
+        std::lock_guard<std::mutex> lock(mtx_);
+        handlers_.push_back(std::move(h));
+        own_handlers_ = true;
+        update_effective();
+        return *this;
+    }
+
+    bool stats_enabled() const
+    {
+        return (filter_.load(std::memory_order_relaxed) & filter_stats_bit) != 0;
+    }
+
+    static uint64_t elapsed_nanoseconds(stats_clock::time_point start)
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(stats_clock::now() - start).count());
+    }
+
+    // Pass the record to the handlers accepting its severity. The text is made only for handlers
+    // that need it, once per distinct formatter. Must be called with mtx_ held.
+    void output(const logu::record& record)
+    {
+        const bool stats = stats_enabled();
+        if (stats && handler_stats_.size() != handlers_.size()) {
+            handler_stats_.resize(handlers_.size());
+        }
+        format_buffer_.clear();
+
+        // Texts already made for this record
+        std::array<formatted_text, 4> texts;
+        size_t text_count = 0;
+
+        for (size_t i = 0; i < handlers_.size(); ++i) {
+            auto& h = handlers_[i];
+            if (record.severity() < h->min_severity()) {
+                continue;
+            }
+            formatted_text text = { nullptr, 0, 0 };
+            if (h->needs_text()) {
+                logu::formatter_base* formatter = (h->formatter() != nullptr) ? h->formatter() : formatter_.get();
+                if (formatter == nullptr) {
+                    continue;
+                }
+                for (size_t t = 0; t < text_count; ++t) {
+                    if (texts[t].formatter == formatter) {
+                        text = texts[t];
+                        break;
+                    }
+                }
+                if (text.formatter == nullptr) {
+                    text = format(record, *formatter, stats);
+                    if (text_count < texts.size()) {
+                        texts[text_count++] = text;
+                    }
+                }
+            }
+            const char* str = (text.formatter != nullptr) ? format_buffer_.data() + text.offset : "";
+            if (stats) {
+                const auto output_start = stats_clock::now();
+                h->output(record, str, text.len);
+                handler_stats_[i].nanoseconds += elapsed_nanoseconds(output_start);
+                handler_stats_[i].bytes += text.len;
+            } else {
+                h->output(record, str, text.len);
+            }
+        }
+    }
+
+    // Text made by a formatter, in format_buffer_
+    struct formatted_text {
+        const logu::formatter_base* formatter;
+        size_t offset;
+        size_t len;
+    };
+
+    // Append the formatted record and a terminating null character to format_buffer_
+    formatted_text format(const logu::record& record, logu::formatter_base& formatter, bool stats)
+    {
+        const auto format_start = stats ? stats_clock::now() : stats_clock::time_point();
+        const size_t offset = format_buffer_.size();
+        formatter.format_to(record, format_buffer_);
+        const size_t len = format_buffer_.size() - offset;
+        format_buffer_.push_back('\0');
+        if (stats) {
+            counters_.format_nanoseconds.fetch_add(elapsed_nanoseconds(format_start), std::memory_order_relaxed);
+            counters_.bytes_formatted.fetch_add(len, std::memory_order_relaxed);
+        }
+        return { &formatter, offset, len };
+    }
+
+    // Returns true if the record repeats the last output one within the window.
+    // Must be called with mtx_ held.
+    bool suppress_repeat(const logu::record& record)
+    {
+        const auto message = record.message_view();
+        const uint32_t hash = logu::internal::murmur3::murmur3_runtime(message.data(), message.size());
+        const bool same = repeat_.valid && same_repeat_location(record) && repeat_.message_size == message.size() && repeat_.message_hash == hash;
+        if (same && (record.time() - repeat_.output_time) < repeat_window_) {
+            ++repeat_.count;
+            repeat_.threadid = record.threadid();
+            std::char_traits<char>::copy(repeat_.threadname, record.threadname(), sizeof(repeat_.threadname));
+            repeat_.time = record.time();
+            return true;
+        }
+        output_repeat();
+        repeat_.valid = true;
+        repeat_.site = record.static_location();
+        if (repeat_.site == nullptr) {
+            repeat_.severity = record.severity();
+            repeat_.tagname = (record.tagname() != nullptr) ? record.tagname() : "";
+            repeat_.file = (record.file() != nullptr) ? record.file() : "";
+            repeat_.func = (record.func() != nullptr) ? record.func() : "";
+            repeat_.line = record.line();
+        }
+        repeat_.message_size = message.size();
+        repeat_.message_hash = hash;
+        repeat_.output_time = record.time();
+        return false;
+    }
+
+    bool same_repeat_location(const logu::record& record) const
+    {
+        if (record.static_location() != nullptr || repeat_.site != nullptr) {
+            return record.static_location() == repeat_.site;
+        }
+        return repeat_.line == record.line() && repeat_.severity == record.severity() && repeat_.file == ((record.file() != nullptr) ? record.file() : "");
+    }
+
+    // Output "last message repeated N times" for the records held back. Must be called with mtx_ held.
+    void output_repeat()
+    {
+        if (repeat_.count != 0) {
+            const logu::source_location location = (repeat_.site != nullptr)
+                ? *repeat_.site
+                : logu::source_location(repeat_.severity, repeat_.tagname.c_str(), repeat_.file.c_str(), repeat_.func.c_str(), repeat_.line);
+            logu::record record(location.severity(), location.tagname(), location.file(), location.func(), location.line(),
+                repeat_.threadid, repeat_.threadname, repeat_.time);
+            record << "last message repeated " << repeat_.count << " times";
+            repeat_.count = 0;
+            output(record);
+        }
+    }
+
+    static constexpr uint32_t make_filter(logu::severity min_severity, logu::severity max_severity, bool enable)
+    {
+        return static_cast<uint32_t>(min_severity) | (static_cast<uint32_t>(max_severity) << 8) | (static_cast<uint32_t>(enable) * filter_enable_bit);
+    }
+
+    static logu::severity filter_min_severity(uint32_t filter) { return static_cast<logu::severity>(filter & 0xff); }
+    static logu::severity filter_max_severity(uint32_t filter) { return static_cast<logu::severity>((filter >> 8) & 0xff); }
+
+    // Recomputes the effective settings from the parent's cached ones and pushes them down to the children,
+    // so records never walk the hierarchy. Must be called with mtx_ held. Locks are always taken from parent to child.
+    void update_effective()
+    {
+        if (parent_ != nullptr && !own_handlers_ && handlers_ != parent_->handlers_) {
+            handlers_ = parent_->handlers_;
+            handler_stats_.clear();
+        }
+        if (parent_ != nullptr && !own_formatter_) {
+            formatter_ = parent_->formatter_;
+        }
+        const uint32_t inherited = (parent_ != nullptr) ? parent_->filter_.load(std::memory_order_relaxed) : filter_.load(std::memory_order_relaxed);
+        uint32_t filter = inherited;
+        if (own_severity_) {
+            filter = make_filter(min_severity_, max_severity_, (filter & filter_enable_bit) != 0);
+        }
+        if (own_enable_) {
+            filter = enable_logging_ ? (filter | filter_enable_bit) : (filter & ~filter_enable_bit);
+        }
+        filter = stats_enabled_ ? (filter | filter_stats_bit) : (filter & ~filter_stats_bit);
+        filter_.store(filter, std::memory_order_relaxed);
+        for (auto child : children_) {
+            std::lock_guard<std::mutex> child_lock(child->mtx_);
+            child->update_effective();
+        }
+    }
 };
 
 namespace internal {
+    // Registry of the loggers by tag name.
+    // Lookups only read atomically published lists. Creating a logger takes the lock.
     class logger_holder : logu::internal::noncopyable {
     public:
-        static logu::logger& get(const char* tagname, bool with_lock = true)
+        static logu::logger& get(const char* tagname)
+        {
+            return instance().find(tagname);
+        }
+
+        // Call func(logu::logger&) for every logger created so far
+        template <typename Func>
+        static void for_each(Func func)
         {
-            static logger_holder instance;
-            return with_lock ? instance.find_with_lock(tagname) : instance.find(tagname);
+            for (auto& bucket : instance().buckets_) {
+                for (node* ptr = bucket.load(std::memory_order_acquire); ptr != nullptr; ptr = ptr->next) {
+                    func(ptr->logger);
+                }
+            }
         }
 
     private:
-        std::unordered_map<std::string, std::unique_ptr<logu::logger>> instances_;
+        struct node {
+            node(const char* tagname, uint32_t tagname_hash, logu::logger* parent, node* next_node)
+                : hash(tagname_hash)
+                , logger(tagname, parent)
+                , next(next_node)
+            {
+            }
+
+            const uint32_t hash;
+            logu::logger logger;
+            node* const next;
+        };
+
+        static constexpr size_t bucket_count = 64;
+        std::array<std::atomic<node*>, bucket_count> buckets_ {};
         std::mutex mtx_;
 
-        logu::logger& find_with_lock(const char* tagname)
+        logger_holder() = default;
+
+        static logger_holder& instance()
         {
-            std::lock_guard<std::mutex> lock(mtx_);
-            return find(tagname);
+            static logger_holder holder;
+            return holder;
+        }
+
+        ~logger_holder()
+        {
+            // Child loggers unregister from their parent, so the deepest names go first and the default logger last
+            std::vector<std::pair<size_t, node*>> nodes;
+            for (auto& bucket : buckets_) {
+                for (node* ptr = bucket.load(std::memory_order_relaxed); ptr != nullptr; ptr = ptr->next) {
+                    const std::string& tagname = ptr->logger.tagname();
+                    const size_t depth = tagname.empty() ? 0 : 1 + std::count(tagname.begin(), tagname.end(), '.');
+                    nodes.emplace_back(depth, ptr);
+                }
+            }
+            std::stable_sort(nodes.begin(), nodes.end(), [](const std::pair<size_t, node*>& a, const std::pair<size_t, node*>& b) { return a.first > b.first; });
+            for (const auto& n : nodes) {
+                delete n.second;
+            }
+        }
+
+        static node* find_node(node* head, const char* tagname, uint32_t hash)
+        {
+            for (node* ptr = head; ptr != nullptr; ptr = ptr->next) {
+                if (ptr->hash == hash && ptr->logger.tagname() == tagname) {
+                    return ptr;
+                }
+            }
+            return nullptr;
         }
 
         logu::logger& find(const char* tagname)
         {
-            auto itr = instances_.find(tagname);
-            if (itr != instances_.end()) {
-                return *itr->second;
-            } else {
-                logu::logger* parent_logger = (*tagname != 0) ? &logger_holder::get("", false) : nullptr;
-                return *(instances_[tagname] = std::unique_ptr<logu::logger>(new logu::logger(tagname, parent_logger)));
+            const uint32_t hash = murmur3::murmur3_runtime(tagname, std::strlen(tagname));
+            std::atomic<node*>& bucket = buckets_[hash % bucket_count];
+            node* found = find_node(bucket.load(std::memory_order_acquire), tagname, hash);
+            if (found != nullptr) {
+                return found->logger;
+            }
+
+            // "net.http.client" inherits from "net.http", which inherits from "net", then from the default logger
+            logu::logger* parent_logger = nullptr;
+            if (*tagname != 0) {
+                const char* dot = std::strrchr(tagname, '.');
+                parent_logger = (dot != nullptr) ? &find(std::string(tagname, dot).c_str()) : &find("");
+            }
+            std::lock_guard<std::mutex> lock(mtx_);
+            node* head = bucket.load(std::memory_order_relaxed);
+            found = find_node(head, tagname, hash);
+            if (found == nullptr) {
+                found = new node(tagname, hash, parent_logger, head);
+                bucket.store(found, std::memory_order_release);
             }
+            return found->logger;
         }
     };
 
+    // Loggers for the tag names sharing the same hash.
+    // Each node remembers the address of the tag name string, so the usual lookup is a pointer comparison.
     template <uint32_t InstanceId>
     class static_logger_holder : logu::internal::noncopyable {
     public:
         static logu::logger& get(const char* tagname)
         {
-            static static_logger_holder<InstanceId> instance(logger_holder::get(tagname, false));
-            return (instance.logger_.tagname() == tagname) ? instance.logger_ : instance.find(tagname);
+            static static_logger_holder<InstanceId> instance(tagname, logger_holder::get(tagname));
+            return (instance.tagname_ == tagname) ? instance.logger_ : instance.find(tagname);
+        }
+
+        ~static_logger_holder()
+        {
+            delete next_.load(std::memory_order_relaxed);
         }
 
     private:
+        const char* const tagname_;
         logu::logger& logger_;
-        std::unique_ptr<static_logger_holder<InstanceId>> next_;
+        std::atomic<static_logger_holder<InstanceId>*> next_ { nullptr };
         std::mutex mtx_;
 
-        static_logger_holder(logu::logger& logger)
-            : logger_(logger)
+        static_logger_holder(const char* tagname, logu::logger& logger)
+            : tagname_(tagname)
+            , logger_(logger)
         {
         }
 
+        // Nodes are only appended, so they can be read without the lock.
+        // Other pointers to the same text match by content, so the chain holds one node per distinct tag name.
+        static_logger_holder<InstanceId>* find_node(const char* tagname)
+        {
+            for (auto ptr = this; ptr != nullptr; ptr = ptr->next_.load(std::memory_order_acquire)) {
+                if (ptr->tagname_ == tagname) {
+                    return ptr;
+                }
+            }
+            for (auto ptr = this; ptr != nullptr; ptr = ptr->next_.load(std::memory_order_acquire)) {
+                if (ptr->logger_.tagname() == tagname) {
+                    return ptr;
+                }
+            }
+            return nullptr;
+        }
+
         logu::logger& find(const char* tagname)
         {
+            auto node = find_node(tagname);
+            if (node != nullptr) {
+                return node->logger_;
+            }
             std::lock_guard<std::mutex> lock(mtx_);
-            static_logger_holder<InstanceId>* ptr = this;
-            bool found = false;
-            while (ptr->next_) {
-                ptr = ptr->next_.get();
-                if (ptr->logger_.tagname() == tagname) {
-                    found = true;
-                    break;
+            node = find_node(tagname);
+            if (node == nullptr) {
+                node = this;
+                while (node->next_.load(std::memory_order_relaxed) != nullptr) {
+                    node = node->next_.load(std::memory_order_relaxed);
+                }
+                auto new_node = new static_logger_holder<InstanceId>(tagname, logger_holder::get(tagname));
+                node->next_.store(new_node, std::memory_order_release);
+                node = new_node;
+            }
+            return node->logger_;
+        }
+    };
+} // namespace internal
+
+// Flush every logger, including the records queued for asynchronous ones
+inline void flush_all()
+{
+    logu::internal::logger_holder::for_each([](logu::logger& logger) { logger.flush(); });
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+namespace internal {
+    template <typename Type = void>
+    struct crash_handler_state {
+        static constexpr size_t signal_count = 5;
+        static const int signals[signal_count];
+        static struct sigaction previous[signal_count];
+        static std::terminate_handler previous_terminate;
+        static std::atomic<bool> crashing;
+        static std::atomic<bool> installed;
+
+        // Write out the sinks with async-signal-safe calls only
+        static void emergency_flush()
+        {
+            if (crashing.exchange(true)) {
+                return;
+            }
+            for (auto& slot : logu::internal::emergency_sinks<>::slots) {
+                logu::sink_base* sink = slot.load(std::memory_order_acquire);
+                if (sink != nullptr) {
+                    sink->emergency_flush();
+                }
+            }
+        }
+
+        static void on_signal(int sig)
+        {
+            emergency_flush();
+            // Restore the previous action and deliver the signal again
+            for (size_t i = 0; i < signal_count; ++i) {
+                if (signals[i] == sig) {
+                    ::sigaction(sig, &previous[i], nullptr);
+                }
+            }
+            ::raise(sig);
+        }
+
+        static void on_terminate()
+        {
+            // Not in a signal handler, so queued records can be output too. A helper thread does it
+            // with a time limit in case this thread holds a logger lock. The flag is shared since the thread
+            // may outlive this function, and the sinks are written out directly only if it did not finish.
+            bool flushed = false;
+            if (!crashing.load()) {
+                const auto done = std::make_shared<std::atomic<bool>>(false);
+                std::thread([done]() {
+                    logu::flush_all();
+                    done->store(true);
+                }).detach();
+                for (int i = 0; i < 1000 && !done->load(); ++i) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
                 }
+                flushed = done->load();
             }
-            if (!found) {
-                ptr->next_ = std::unique_ptr<static_logger_holder<InstanceId>>(
-                    new static_logger_holder<InstanceId>(logger_holder::get(tagname, false)));
-                ptr = ptr->next_.get();
+            if (!flushed) {
+                emergency_flush();
             }
-            return ptr->logger_;
+            if (previous_terminate != nullptr) {
+                previous_terminate();
+            }
+            std::abort();
         }
     };
+
+    template <typename Type>
+    const int crash_handler_state<Type>::signals[crash_handler_state<Type>::signal_count] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+    template <typename Type>
+    struct sigaction crash_handler_state<Type>::previous[crash_handler_state<Type>::signal_count];
+    template <typename Type>
+    std::terminate_handler crash_handler_state<Type>::previous_terminate = nullptr;
+    template <typename Type>
+    std::atomic<bool> crash_handler_state<Type>::crashing { false };
+    template <typename Type>
+    std::atomic<bool> crash_handler_state<Type>::installed { false };
 } // namespace internal
 
+// Give the calling thread an alternate signal stack, so that the crash handler also runs when the thread
+// overflows its stack. Threads that already have one keep it.
+inline void install_crash_stack()
+{
+    static thread_local std::unique_ptr<char[]> stack;
+    stack_t current;
+    if (stack || (::sigaltstack(nullptr, &current) == 0 && (current.ss_flags & SS_DISABLE) == 0)) {
+        return;
+    }
+    const size_t size = 64 * 1024;
+    stack.reset(new char[size]);
+    stack_t alternate;
+    std::memset(&alternate, 0, sizeof(alternate));
+    alternate.ss_sp = stack.get();
+    alternate.ss_size = size;
+    if (::sigaltstack(&alternate, nullptr) != 0) {
+        stack.reset();
+    }
+}
+
+// Write out the buffers of the sinks when the process dies by SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT
+// or std::terminate, then let the previous handler run. Records still in asynchronous queues are
+// output only on std::terminate, because formatting them is not async-signal-safe.
+// A stack overflow is handled only in threads with an alternate signal stack: the calling thread gets one,
+// and other threads can call install_crash_stack.
+inline void install_crash_handler()
+{
+    using state = logu::internal::crash_handler_state<>;
+    logu::install_crash_stack();
+    if (state::installed.exchange(true)) {
+        return;
+    }
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = &state::on_signal;
+    action.sa_flags = SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < state::signal_count; ++i) {
+        ::sigaction(state::signals[i], &action, &state::previous[i]);
+    }
+    state::previous_terminate = std::set_terminate(&state::on_terminate);
+}
+#endif
+
+// Static descriptor of one logging statement.
+// Every call site is registered on first use and can be enabled or disabled on its own.
+class call_site : public logu::source_location, logu::internal::noncopyable {
+public:
+    enum class state : uint8_t {
+        inherit, // Follow the severity and enable settings of the logger
+        enabled, // Always output
+        disabled // Never output
+    };
+
+    call_site(logu::severity severity, const char* tagname, const char* file, const char* func, size_t line, logu::logger& logger)
+        : logu::source_location(severity, tagname, file, func, line)
+        , logger_(logger)
+        , next_(head().load(std::memory_order_relaxed))
+    {
+        while (!head().compare_exchange_weak(next_, this, std::memory_order_release, std::memory_order_relaxed)) { }
+    }
+
+    bool should_output() const
+    {
+        const auto current = static_cast<state>(state_.load(std::memory_order_relaxed));
+        return (current == state::inherit) ? logger_.should_output(severity()) : (current == state::enabled);
+    }
+
+    logu::logger& logger() const { return logger_; }
+
+    call_site& set_state(state new_state)
+    {
+        state_.store(static_cast<uint8_t>(new_state), std::memory_order_relaxed);
+        return *this;
+    }
+
+    state get_state() const { return static_cast<state>(state_.load(std::memory_order_relaxed)); }
+
+    // Call func for every registered call site, the most recently registered first
+    static void for_each(const std::function<void(logu::call_site&)>& func)
+    {
+        for (auto site = head().load(std::memory_order_acquire); site != nullptr; site = site->next_) {
+            func(*site);
+        }
+    }
+
+private:
+    logu::logger& logger_;
+    std::atomic<uint8_t> state_ { static_cast<uint8_t>(state::inherit) };
+    logu::call_site* next_;
+
+    static std::atomic<logu::call_site*>& head()
+    {
+        static std::atomic<logu::call_site*> instance { nullptr };
+        return instance;
+    }
+};
+
 namespace internal {
 
 #if defined(_MSC_VER) && defined(LOGU_ENABLE_PLATFORM_LOGGER_WINDOWS)
@@ -768,6 +5462,12 @@ namespace internal {
 
 } // namespace internal
 
+// Set the name of the calling thread printed by formatter::option::threadname (up to 15 characters)
+inline void set_thread_name(const char* name)
+{
+    logu::internal::set_threadname(name);
+}
+
 inline void platform_logger(const logu::record& record, const char* str)
 {
     (void)record;
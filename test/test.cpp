@@ -1,11 +1,25 @@
-﻿#include "logu/logu.hpp"
+﻿#define LOGU_ENABLE_IO_URING
+#include "logu/logu.hpp"
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <atomic>
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <regex>
 #include <string>
+#include <thread>
 #include <vector>
 
+#if defined(__linux__)
+#include <sys/wait.h>
+#endif
+
 // #define TEST_ENABLE_OUTPUT_TO_STDOUT
 
 logu::logger g_default_logger("");
@@ -511,3 +525,1111 @@ TEST_F(LoguTest, InheritDefault)
     str = testing::internal::GetCapturedStdout();
     EXPECT_TRUE(std::regex_match(str, std::regex(get_pattern(logu::severity::debug, "inherit") + "DEBUG\\n")));
 }
+
+TEST_F(LoguTest, Async)
+{
+    constexpr auto name = "Async";
+    constexpr int thread_count = 4;
+    constexpr int count = 1000;
+    std::vector<std::string> lines;
+    const auto producer_threadid = logu::internal::get_threadid();
+    uint64_t output_threadid = 0;
+
+    LOGU_LOGGER(name)
+        .set_formatter(
+            logu::formatter()
+                .set_option(logu::formatter::option::datetime, false)
+                .set_option(logu::formatter::option::severity, false)
+                .set_option(logu::formatter::option::threadid, false)
+                .set_option(logu::formatter::option::file, false)
+                .set_option(logu::formatter::option::func, false)
+                .set_option(logu::formatter::option::tagname, false))
+        .set_handler(std::function<void(const logu::record&, const char*)>([&](const logu::record& record, const char* str) {
+            lines.emplace_back(str);
+            output_threadid = record.threadid();
+        }))
+        .set_async(true, 64);
+    EXPECT_TRUE(LOGU_LOGGER(name).is_async());
+
+    LOGU_(name) << "first";
+    LOGU_LOGGER(name).flush();
+    ASSERT_EQ(1, lines.size());
+    EXPECT_EQ("first", lines[0]);
+    EXPECT_EQ(producer_threadid, output_threadid);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < count; ++i) {
+                LOGU_(name) << i;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    LOGU_LOGGER(name).flush();
+    EXPECT_EQ(1 + thread_count * count, lines.size());
+
+    LOGU_LOGGER(name).set_async(false);
+    EXPECT_FALSE(LOGU_LOGGER(name).is_async());
+    LOGU_(name) << "last";
+    EXPECT_EQ("last", lines.back());
+}
+
+TEST_F(LoguTest, Backpressure)
+{
+    // The worker is held in the handler until open, so the small queue overflows
+    std::atomic<bool> open(false);
+    std::vector<std::string> lines;
+    const auto setup = [&](const char* name, logu::backpressure_policy policy) {
+        open = false;
+        lines.clear();
+        LOGU_LOGGER(name)
+            .reset_stats()
+            .set_formatter(logu::pattern_formatter("{message}"))
+            .set_handler(std::function<void(const logu::record&, const char*)>([&](const logu::record&, const char* str) {
+                while (!open) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                lines.emplace_back(str);
+            }))
+            .set_async(true, 4, policy.set_report_interval(std::chrono::milliseconds(0)));
+    };
+    // Sum of "N records dropped" lines
+    const auto reported = [&]() {
+        uint64_t count = 0;
+        for (const auto& line : lines) {
+            if (line.find(" records dropped") != std::string::npos) {
+                count += std::stoull(line);
+            }
+        }
+        return count;
+    };
+    const auto teardown = [](const char* name) {
+        LOGU_LOGGER(name).set_async(false).set_handler(std::cout);
+    };
+
+    {
+        constexpr auto name = "BackpressureNewest";
+        setup(name, logu::backpressure_policy().set_overflow(logu::backpressure_policy::overflow::drop_newest));
+        for (int i = 0; i < 100; ++i) {
+            LOGU_INFO_(name) << i;
+        }
+        open = true;
+        LOGU_LOGGER(name).flush();
+        EXPECT_LE(95u, reported());
+        EXPECT_EQ(100u, lines.size() - std::count_if(lines.begin(), lines.end(), [](const std::string& line) { return line.find("dropped") != std::string::npos; }) + reported());
+        EXPECT_EQ("0", lines.front());
+        EXPECT_EQ(reported(), LOGU_LOGGER(name).stats().dropped);
+        teardown(name);
+    }
+
+    {
+        constexpr auto name = "BackpressureOldest";
+        setup(name, logu::backpressure_policy().set_overflow(logu::backpressure_policy::overflow::drop_oldest));
+        for (int i = 0; i < 100; ++i) {
+            LOGU_INFO_(name) << i;
+        }
+        open = true;
+        LOGU_LOGGER(name).flush();
+        EXPECT_LE(95u, reported());
+        EXPECT_NE(lines.end(), std::find(lines.begin(), lines.end(), "99"));
+        EXPECT_EQ(reported(), LOGU_LOGGER(name).stats().dropped);
+        teardown(name);
+    }
+
+    {
+        // Blocks for warn and above
+        constexpr auto name = "BackpressureSeverity";
+        setup(name, logu::backpressure_policy().set_drop_below(logu::severity::warn));
+        for (int i = 0; i < 100; ++i) {
+            LOGU_INFO_(name) << i;
+        }
+        open = true;
+        for (int i = 0; i < 100; ++i) {
+            LOGU_WARN_(name) << "w" << i;
+        }
+        LOGU_LOGGER(name).flush();
+        EXPECT_EQ(100, std::count_if(lines.begin(), lines.end(), [](const std::string& line) { return line[0] == 'w'; }));
+        EXPECT_LE(95u, reported());
+        teardown(name);
+    }
+
+    {
+        constexpr auto name = "BackpressureBytes";
+        setup(name, logu::backpressure_policy().set_overflow(logu::backpressure_policy::overflow::drop_newest).set_max_bytes(2 * sizeof(logu::record) + 8));
+        for (int i = 0; i < 100; ++i) {
+            LOGU_INFO_(name) << i;
+        }
+        open = true;
+        LOGU_LOGGER(name).flush();
+        EXPECT_LE(96u, reported());
+        teardown(name);
+    }
+}
+
+TEST_F(LoguTest, MessageBuffer)
+{
+    logu::record record(logu::severity::info, "", "test.cpp", "func", 1);
+    const char* null_str = nullptr;
+    record << "abc" << 123 << -45 << ' ' << std::string("str") << ' ' << 1.5 << ' ' << null_str << ' ' << true;
+    EXPECT_EQ("abc123-45 str 1.5 (null) 1", record.message());
+
+    record << ' ' << std::hex << 255 << std::dec << ' ' << 255;
+    EXPECT_EQ("abc123-45 str 1.5 (null) 1 ff 255", record.message());
+
+    const std::string expect = record.message() + std::string(1000, 'x');
+    record << std::string(1000, 'x');
+    const auto view = record.message_view();
+    EXPECT_EQ(expect.size(), view.size());
+    EXPECT_EQ(expect, view.str());
+
+    logu::record moved(std::move(record));
+    EXPECT_EQ(expect, moved.message());
+
+    // Floating-point values are written as std::ostream would without creating one
+    std::ostringstream oss;
+    logu::record floats(logu::severity::info, "", "test.cpp", "func", 1);
+    for (double d : { 0.1, 1e-5, 123456789.0, -0.0, 1.0 / 3, 1e300, 100.0, HUGE_VAL }) {
+        oss << d << ' ';
+        floats << d << ' ';
+    }
+    oss << 3.14159f << ' ' << 2.5L;
+    floats << 3.14159f << ' ' << 2.5L;
+    EXPECT_EQ(oss.str(), floats.message());
+
+    // The stream state is kept across a move
+    logu::record hex(logu::severity::info, "", "test.cpp", "func", 1);
+    hex << std::hex << std::setfill('0') << std::setw(4) << 255;
+    logu::record moved_hex(std::move(hex));
+    moved_hex << ' ' << 255;
+    EXPECT_EQ("00ff ff", moved_hex.message());
+}
+
+TEST_F(LoguTest, ThreadInfo)
+{
+    constexpr auto name = "ThreadInfo";
+    std::string str;
+    LOGU_LOGGER(name)
+        .set_formatter(
+            logu::formatter()
+                .set_option(logu::formatter::option::datetime, false)
+                .set_option(logu::formatter::option::severity, false)
+                .set_option(logu::formatter::option::threadid, false)
+                .set_option(logu::formatter::option::threadname, true)
+                .set_option(logu::formatter::option::file, false)
+                .set_option(logu::formatter::option::func, false)
+                .set_option(logu::formatter::option::tagname, false));
+
+    std::thread([&]() {
+        logu::set_thread_name("worker-thread-name-too-long");
+        testing::internal::CaptureStdout();
+        LOGU_(name) << "test";
+        str = testing::internal::GetCapturedStdout();
+    }).join();
+    EXPECT_EQ("worker-thread-n | test\n", str);
+
+    const auto threadid = logu::internal::get_threadid();
+    EXPECT_EQ(threadid, logu::record(logu::severity::none, "", "", "", 0).threadid());
+#if defined(__linux__)
+    const pid_t pid = fork();
+    if (pid == 0) {
+        _exit(logu::internal::get_threadid() == static_cast<uint64_t>(getpid()) ? 0 : 1);
+    }
+    int status = -1;
+    waitpid(pid, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+#endif
+}
+
+TEST_F(LoguTest, DatetimeCache)
+{
+    const time_t base = 1700000000;
+    for (time_t t : { base, base, base + 1, base + 86400 * 40, base + 1 }) {
+        struct tm localt = {};
+        logu::internal::localtime_s(&localt, &t);
+        char expect[32];
+        char actual[32];
+        std::strftime(expect, sizeof(expect), "%Y-%m-%d %H:%M:%S", &localt);
+        *logu::internal::format_datetime(actual, t, true) = '\0';
+        EXPECT_STREQ(expect, actual);
+        std::strftime(expect, sizeof(expect), "%m-%d %H:%M:%S", &localt);
+        *logu::internal::format_datetime(actual, t, false) = '\0';
+        EXPECT_STREQ(expect, actual);
+    }
+}
+
+TEST_F(LoguTest, PatternFormatter)
+{
+    constexpr auto name = "PatternFormatter";
+    std::string str;
+
+    LOGU_LOGGER(name).set_formatter(logu::pattern_formatter());
+    testing::internal::CaptureStdout();
+    LOGU_WARN_(name) << "test";
+    str = testing::internal::GetCapturedStdout();
+    EXPECT_TRUE(std::regex_match(str, std::regex("\\d{4}-\\d{2}-\\d{2} \\d{2}:\\d{2}:\\d{2}\\.\\d{3} \\| WARN  \\| \\d+ \\| test\\.cpp@\\d+ \\| test\\n")));
+
+    LOGU_LOGGER(name).set_formatter(logu::pattern_formatter("{message} <{tag}> {{{line}}} {unknown} {severity"));
+    testing::internal::CaptureStdout();
+    LOGU_ERROR_(name) << "test";
+    str = testing::internal::GetCapturedStdout();
+    EXPECT_TRUE(std::regex_match(str, std::regex("test <PatternFormatter> \\{\\d+\\} \\{unknown\\} \\{severity\\n")));
+
+    LOGU_LOGGER(name).set_formatter(logu::pattern_formatter("{time} {datetime_us}|{func}|{file}"));
+    testing::internal::CaptureStdout();
+    LOGU_(name) << "test";
+    str = testing::internal::GetCapturedStdout();
+    EXPECT_TRUE(std::regex_match(str, std::regex("\\d{2}-\\d{2} \\d{2}:\\d{2}:\\d{2}\\.\\d{3} \\d{4}-\\d{2}-\\d{2} \\d{2}:\\d{2}:\\d{2}\\.\\d{6}\\|.*TestBody.*\\|test\\.cpp\\n")));
+}
+
+static std::string ReadFile(const char* filename)
+{
+    std::ifstream ifs(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+
+TEST_F(LoguTest, FileSink)
+{
+    constexpr auto name = "FileSink";
+    constexpr auto filename = "logu_test_file_sink.log";
+    auto sink = std::make_shared<logu::file_sink>(
+        filename,
+        logu::flush_policy()
+            .set_buffer_size(16)
+            .set_interval(std::chrono::milliseconds(0))
+            .set_severity(logu::severity::warn));
+    ASSERT_TRUE(sink->is_open());
+    LOGU_LOGGER(name)
+        .set_formatter(logu::pattern_formatter("{message}"))
+        .set_handler(sink);
+
+    LOGU_DEBUG_(name) << "1234";
+    EXPECT_EQ("", ReadFile(filename));
+
+    // Severity
+    LOGU_WARN_(name) << "5678";
+    EXPECT_EQ("1234\n5678\n", ReadFile(filename));
+
+    // Buffer size
+    LOGU_DEBUG_(name) << "abcdefgh";
+    EXPECT_EQ("1234\n5678\n", ReadFile(filename));
+    LOGU_DEBUG_(name) << "ijklmnop";
+    EXPECT_EQ("1234\n5678\nabcdefgh\nijklmnop\n", ReadFile(filename));
+
+    // Explicit
+    LOGU_DEBUG_(name) << "end";
+    EXPECT_EQ("1234\n5678\nabcdefgh\nijklmnop\n", ReadFile(filename));
+    LOGU_LOGGER(name).flush();
+    EXPECT_EQ("1234\n5678\nabcdefgh\nijklmnop\nend\n", ReadFile(filename));
+
+    // Interval, without another record to trigger it
+    LOGU_LOGGER(name).set_handler(std::make_shared<logu::file_sink>(filename, logu::flush_policy().set_interval(std::chrono::milliseconds(10))));
+    LOGU_DEBUG_(name) << "timer";
+    for (int i = 0; i < 500 && ReadFile(filename).empty(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ("timer\n", ReadFile(filename));
+
+    LOGU_LOGGER(name).set_handler(std::cout);
+    std::remove(filename);
+}
+
+TEST_F(LoguTest, RotatingFileSink)
+{
+    constexpr auto name = "RotatingFileSink";
+    constexpr auto filename = "logu_test_rotating_file_sink.log";
+    const std::string spare_filename = std::string(filename) + ".next";
+    std::remove(filename);
+
+    // Rotated files of an earlier run are counted, oldest first
+    const std::vector<std::string> earlier = { std::string(filename) + ".20200101-000000", std::string(filename) + ".20200101-000000-2",
+        std::string(filename) + ".20200101-000000-10" };
+    for (const auto& f : earlier) {
+        std::ofstream(f) << "earlier\n";
+    }
+    std::ofstream(std::string(filename) + ".20200101-0000") << "not rotated\n";
+
+    {
+        auto sink = std::make_shared<logu::rotating_file_sink>(
+            filename,
+            logu::rotation_policy().set_max_size(20).set_max_files(2),
+            logu::flush_policy().set_buffer_size(1));
+        ASSERT_TRUE(sink->is_open());
+        EXPECT_EQ(earlier, sink->rotated_filenames());
+        LOGU_LOGGER(name)
+            .set_formatter(logu::pattern_formatter("{message}"))
+            .set_handler(sink);
+
+        // Wait until the rotator thread has moved the file and prepared the next one
+        std::string last_rotated;
+        const auto wait_for_rotator = [&](bool rotated) {
+            for (int i = 0; i < 200; ++i) {
+                const auto filenames = sink->rotated_filenames();
+                const bool done = !rotated || (!filenames.empty() && filenames.back() != last_rotated);
+                if (done && std::ifstream(spare_filename).good()) {
+                    last_rotated = filenames.empty() ? "" : filenames.back();
+                    return;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        };
+
+        wait_for_rotator(false);
+        for (int i = 0; i < 4; ++i) {
+            LOGU_(name) << "line" << i << "-a";
+            LOGU_(name) << "line" << i << "-b";
+            wait_for_rotator(i != 0);
+        }
+
+        EXPECT_EQ("line3-a\nline3-b\n", ReadFile(filename));
+        const auto rotated = sink->rotated_filenames();
+        ASSERT_EQ(2, rotated.size());
+        EXPECT_EQ("line1-a\nline1-b\n", ReadFile(rotated[0].c_str()));
+        EXPECT_EQ("line2-a\nline2-b\n", ReadFile(rotated[1].c_str()));
+        for (const auto& f : rotated) {
+            std::remove(f.c_str());
+        }
+        LOGU_LOGGER(name).set_handler(std::cout);
+    }
+    EXPECT_FALSE(std::ifstream(spare_filename).good());
+    for (const auto& f : earlier) {
+        EXPECT_FALSE(std::ifstream(f).good()) << f;
+    }
+    EXPECT_TRUE(std::ifstream(std::string(filename) + ".20200101-0000").good());
+    std::remove((std::string(filename) + ".20200101-0000").c_str());
+    std::remove(filename);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+TEST_F(LoguTest, WritevSink)
+{
+    constexpr auto name = "WritevSink";
+    constexpr int count = 20000;
+
+    // A non-blocking pipe drained slowly, so writes are partial and have to wait
+    int fds[2];
+    ASSERT_EQ(0, ::pipe(fds));
+    ASSERT_EQ(0, ::fcntl(fds[1], F_SETFL, ::fcntl(fds[1], F_GETFL) | O_NONBLOCK));
+    std::string received;
+    std::thread reader([&received, &fds]() {
+        char buf[4096];
+        ssize_t n;
+        while ((n = ::read(fds[0], buf, sizeof(buf))) > 0) {
+            received.append(buf, static_cast<size_t>(n));
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+
+    auto sink = std::make_shared<logu::writev_sink>(
+        fds[1],
+        logu::flush_policy()
+            .set_buffer_size(256 * 1024)
+            .set_interval(std::chrono::milliseconds(0))
+            .set_severity(logu::severity::none));
+    ASSERT_TRUE(sink->is_open());
+    LOGU_LOGGER(name)
+        .set_formatter(logu::pattern_formatter("{message}"))
+        .set_handler(sink);
+
+    std::string expected;
+    for (int i = 0; i < count; ++i) {
+        LOGU_INFO_(name) << "line " << i;
+        expected += "line " + std::to_string(i) + "\n";
+    }
+    LOGU_LOGGER(name).flush();
+    LOGU_LOGGER(name).set_handler(std::cout);
+    ::close(fds[1]);
+    reader.join();
+    ::close(fds[0]);
+
+    EXPECT_EQ(expected, received);
+    EXPECT_LT(sink->writev_calls(), static_cast<uint64_t>(count / 100));
+
+    // Interval, without another record to trigger it
+    constexpr auto filename = "logu_test_writev_sink.log";
+    LOGU_LOGGER(name).set_handler(std::make_shared<logu::writev_sink>(filename, logu::flush_policy().set_interval(std::chrono::milliseconds(10))));
+    LOGU_INFO_(name) << "timer";
+    for (int i = 0; i < 500 && ReadFile(filename).empty(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ("timer\n", ReadFile(filename));
+    LOGU_LOGGER(name).set_handler(std::cout);
+    std::remove(filename);
+}
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+TEST_F(LoguTest, AsyncFileSink)
+{
+    constexpr auto name = "AsyncFileSink";
+    constexpr auto filename = "logu_test_async_file_sink.log";
+
+    // io_uring when available, then the pwrite threads
+    for (bool io_uring : { true, false }) {
+        std::string expected;
+        {
+            auto sink = std::make_shared<logu::async_file_sink>(
+                filename,
+                logu::flush_policy()
+                    .set_buffer_size(4096)
+                    .set_interval(std::chrono::milliseconds(0))
+                    .set_severity(logu::severity::none),
+                logu::async_io_policy()
+                    .set_buffer_count(3)
+                    .set_datasync(!io_uring)
+                    .set_io_uring(io_uring));
+            ASSERT_TRUE(sink->is_open());
+            if (io_uring && !sink->uses_io_uring()) {
+                std::cout << "[  SKIPPED ] io_uring is not available" << std::endl;
+                continue;
+            }
+            EXPECT_EQ(io_uring, sink->uses_io_uring());
+            LOGU_LOGGER(name)
+                .set_formatter(logu::pattern_formatter("{message}"))
+                .set_handler(sink);
+
+            for (int i = 0; i < 5000; ++i) {
+                LOGU_INFO_(name) << "line " << i;
+                expected += "line " + std::to_string(i) + "\n";
+            }
+            // A line longer than a buffer
+            LOGU_INFO_(name) << std::string(10000, 'x');
+            expected += std::string(10000, 'x') + "\n";
+
+            LOGU_LOGGER(name).flush();
+            EXPECT_EQ(expected, ReadFile(filename));
+            EXPECT_EQ(0u, sink->failed_writes());
+            LOGU_LOGGER(name).set_handler(std::cout);
+        }
+        std::remove(filename);
+    }
+
+    // Lines that do not fit in the free buffers are dropped and reported instead of waiting
+    {
+        auto sink = std::make_shared<logu::async_file_sink>(
+            filename,
+            logu::flush_policy().set_buffer_size(4096).set_severity(logu::severity::none),
+            logu::async_io_policy()
+                .set_buffer_count(2)
+                .set_threads(1)
+                .set_backpressure(logu::backpressure_policy().set_overflow(logu::backpressure_policy::overflow::drop_newest)));
+        LOGU_LOGGER(name)
+            .set_formatter(logu::pattern_formatter("{message}"))
+            .set_handler(sink);
+        constexpr int count = 100000;
+        for (int i = 0; i < count; ++i) {
+            LOGU_INFO_(name) << "line " << i;
+        }
+        LOGU_LOGGER(name).flush();
+        LOGU_LOGGER(name).set_handler(std::cout);
+
+        std::istringstream lines(ReadFile(filename));
+        std::string line;
+        uint64_t written = 0, reported = 0;
+        while (std::getline(lines, line)) {
+            if (line.compare(0, 5, "line ") == 0) {
+                ++written;
+            } else {
+                EXPECT_NE(std::string::npos, line.find(" records dropped")) << line;
+                reported += std::stoull(line);
+            }
+        }
+        EXPECT_EQ(static_cast<uint64_t>(count), written + sink->dropped_lines());
+        EXPECT_EQ(sink->dropped_lines(), reported);
+    }
+    std::remove(filename);
+
+    // Interval, without another record to trigger it
+    LOGU_LOGGER(name).set_handler(std::make_shared<logu::async_file_sink>(filename, logu::flush_policy().set_interval(std::chrono::milliseconds(10))));
+    LOGU_INFO_(name) << "timer";
+    for (int i = 0; i < 500 && ReadFile(filename).empty(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ("timer\n", ReadFile(filename));
+    LOGU_LOGGER(name).set_handler(std::cout);
+    std::remove(filename);
+}
+#endif
+
+#if defined(__linux__) && !defined(__SANITIZE_THREAD__) && !defined(__SANITIZE_ADDRESS__)
+// Recurse until the stack runs out
+static int OverflowStack(int depth)
+{
+    volatile char frame[1024];
+    frame[0] = static_cast<char>(depth);
+    return (depth < 0) ? 0 : OverflowStack(depth + 1) + frame[0];
+}
+#endif
+
+TEST_F(LoguTest, CrashHandler)
+{
+    constexpr auto name = "CrashHandler";
+    constexpr auto filename = "logu_test_crash_handler.log";
+    const auto make_sink = [filename]() {
+        return std::make_shared<logu::file_sink>(filename, logu::flush_policy().set_interval(std::chrono::milliseconds(0)));
+    };
+    LOGU_LOGGER(name).set_formatter(logu::pattern_formatter("{message}")).set_handler(make_sink());
+
+    LOGU_INFO_(name) << "buffered";
+    EXPECT_EQ("", ReadFile(filename));
+    logu::flush_all();
+    EXPECT_EQ("buffered\n", ReadFile(filename));
+    LOGU_LOGGER(name).set_handler(std::cout);
+
+#if defined(__linux__) && !defined(__SANITIZE_THREAD__) && !defined(__SANITIZE_ADDRESS__)
+    // The child dies with the buffered records written out.
+    // Records queued for an async logger are output on std::terminate.
+    enum class crash { signal, overflow, terminate };
+    for (crash how : { crash::signal, crash::overflow, crash::terminate }) {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            LOGU_LOGGER(name).set_handler(make_sink()).set_async(how == crash::terminate);
+            logu::install_crash_handler();
+            LOGU_INFO_(name) << "last words";
+            if (how == crash::terminate) {
+                std::terminate();
+            } else if (how == crash::overflow) {
+                OverflowStack(0);
+            }
+            raise(SIGSEGV);
+            _exit(0);
+        }
+        int status = -1;
+        waitpid(pid, &status, 0);
+        EXPECT_TRUE(WIFSIGNALED(status));
+        EXPECT_EQ(how == crash::terminate ? SIGABRT : SIGSEGV, WTERMSIG(status));
+        EXPECT_EQ("last words\n", ReadFile(filename));
+    }
+#endif
+    std::remove(filename);
+}
+
+TEST_F(LoguTest, BinarySink)
+{
+    constexpr auto name = "BinarySink";
+    constexpr auto filename = "logu_test_binary_sink.bin";
+    std::vector<std::string> expect;
+
+    LOGU_LOGGER(name)
+        .set_formatter(logu::formatter().set_option(logu::formatter::option::threadname, true))
+        .set_handler(std::make_shared<logu::binary_sink>(filename),
+            std::function<void(const logu::record&, const char*)>([&](const logu::record&, const char* str) {
+                expect.emplace_back(str);
+            }));
+    for (int i = 0; i < 3; ++i) {
+        LOGU_INFO_(name) << "message " << i;
+        LOGU_ERROR_(name) << std::string(300, 'a' + i);
+    }
+    LOGU_WARN_(name).set_suppressed(7) << "suppressed";
+    LOGU_WARN_(name).kv("i", -1).kv("u", 2u).kv("d", 0.25).kv("b", true).kv("s", std::string("x y")) << "fields";
+    LOGU_LOGGER(name).set_handler(std::cout);
+
+    logu::binary_reader reader(filename);
+    ASSERT_TRUE(reader.is_valid());
+    logu::formatter formatter;
+    formatter.set_option(logu::formatter::option::threadname, true);
+    std::vector<std::string> actual;
+    while (reader.read_next([&](const logu::record& record) { actual.push_back(formatter.format(record)); })) { }
+    EXPECT_EQ(expect, actual);
+
+    // Call sites whose strings reuse the same address are told apart by content
+    {
+        logu::binary_sink sink(filename);
+        for (int i = 0; i < 4; ++i) {
+            const std::string file = "file" + std::to_string(i % 2) + ".cpp";
+            logu::record record(logu::severity::info, name, file.c_str(), "func", 1);
+            record << "message";
+            sink.write(record, "", 0);
+        }
+    }
+    logu::binary_reader files(filename);
+    std::vector<std::string> actual_files;
+    while (files.read_next([&](const logu::record& record) { actual_files.emplace_back(record.file()); })) { }
+    EXPECT_EQ(std::vector<std::string>({ "file0.cpp", "file1.cpp", "file0.cpp", "file1.cpp" }), actual_files);
+    std::remove(filename);
+}
+
+TEST_F(LoguTest, FormatChecked)
+{
+    const auto format = [](logu::record&& record) { return record.message(); };
+    const auto make_record = []() { return logu::record(logu::severity::none, "", "", "", 0); };
+
+    const std::string long_str(3000, 'x');
+    EXPECT_EQ(long_str + "!", format(make_record().format("%s!", long_str)));
+
+    EXPECT_EQ("[  abc|ab   |00042|-42|2a|ffffffff|3.14|1.5e+00|c|%]",
+        format(make_record().format("[%5s|%-5.2s|%05d|%d|%x|%x|%.2f|%.1e|%c|%%]", "abc", std::string("abc"), 42, -42L, 42u, -1, 3.14159, 1.5, 'c')));
+    EXPECT_EQ("[   7|7   |18446744073709551615|3.000000]", format(make_record().format("[%*d|%-*d|%llu|%f]", 4, 7, 4, 7, static_cast<unsigned long long>(-1), 3)));
+
+    // Mismatches do not crash and are reported in place
+    EXPECT_EQ("%!d(string) %!s(int)", format(make_record().format("%d %s", "abc", 1)));
+    EXPECT_EQ("1 %!d(MISSING)", format(make_record().format("%d %d", 1)));
+    EXPECT_EQ("1%!(EXTRA double)", format(make_record().format("%d", 1, 2.0)));
+    EXPECT_EQ("(null)", format(make_record().format("%s", static_cast<const char*>(nullptr))));
+
+    // Widths and precisions beyond int
+    EXPECT_EQ("%!d(BADWIDTH)%!(EXTRA int)", format(make_record().format("%+ #0-*.*d", -1000000000000000000LL, 1000000000000000000LL, 1)));
+    EXPECT_EQ("%!d(BADWIDTH)%!(EXTRA int)", format(make_record().format("%99999999999999999999d", 1)));
+    EXPECT_EQ("%!d(BADWIDTH)%!(EXTRA int)", format(make_record().format("%.99999999999d", 1)));
+    EXPECT_EQ("1  |", format(make_record().format("%*d|", -3, 1)));
+}
+
+TEST_F(LoguTest, CallSiteLogger)
+{
+    // Distinct strings with the same tag name resolve to the same logger
+    using holder = logu::internal::static_logger_holder<LOGU_HASH("CallSiteLogger")>;
+    const std::string copy = "CallSiteLogger";
+    EXPECT_EQ(&LOGU_LOGGER_STATIC("CallSiteLogger"), &holder::get(copy.c_str()));
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(&LOGU_LOGGER_STATIC("CallSiteLogger"), &holder::get(std::string(copy).c_str()));
+    }
+    EXPECT_EQ(&LOGU_LOGGER("CallSiteLogger"), &LOGU_LOGGER_STATIC("CallSiteLogger"));
+
+    // Settings changed after the first call are seen by the cached call site
+    std::string str;
+    for (int i = 0; i < 2; ++i) {
+        LOGU_LOGGER("CallSiteLogger").set_severity(i == 0 ? logu::severity::info : logu::severity::warn);
+        testing::internal::CaptureStdout();
+        LOGU_INFO_("CallSiteLogger") << "test";
+        str = testing::internal::GetCapturedStdout();
+        EXPECT_EQ(i == 0, !str.empty());
+    }
+
+    // The statement is evaluated at most once and keeps if/else semantics
+    int count = 0;
+    if (count == 0)
+        LOGU_WARN_("CallSiteLogger") << ++count;
+    else
+        count = 100;
+    EXPECT_EQ(1, count);
+}
+
+TEST_F(LoguTest, FilterInheritance)
+{
+    logu::logger parent("FilterParent");
+    logu::logger child("FilterChild", &parent);
+    logu::logger grandchild("FilterGrandchild", &child);
+
+    // Changes reach loggers created before them
+    parent.set_severity(logu::severity::warn);
+    EXPECT_FALSE(grandchild.should_output(logu::severity::info));
+    EXPECT_TRUE(grandchild.should_output(logu::severity::warn));
+
+    // Own settings stop the inheritance of that setting only
+    child.set_severity(logu::severity::debug, logu::severity::info);
+    parent.set_severity(logu::severity::error);
+    EXPECT_TRUE(grandchild.should_output(logu::severity::debug));
+    EXPECT_FALSE(grandchild.should_output(logu::severity::warn));
+    parent.set_enable(false);
+    EXPECT_FALSE(grandchild.should_output(logu::severity::debug));
+    child.set_enable(true);
+    EXPECT_TRUE(grandchild.should_output(logu::severity::debug));
+    EXPECT_FALSE(parent.should_output(logu::severity::error));
+
+    // Settings may change while other threads are logging
+    std::atomic<int> count(0);
+    parent.set_enable(true).set_handler([&count](const logu::record&) { ++count; });
+    std::atomic<bool> stop(false);
+    std::thread writer([&]() {
+        while (!stop) {
+            if (parent.should_output(logu::severity::error)) {
+                parent += logu::record(logu::severity::error, "FilterParent", "", "", 0);
+            }
+        }
+    });
+    for (int i = 0; i < 1000; ++i) {
+        parent.set_enable(i % 2 == 0).set_severity(i % 3 == 0 ? logu::severity::error : logu::severity::debug);
+    }
+    stop = true;
+    writer.join();
+    EXPECT_TRUE(parent.set_enable(true).should_output(logu::severity::error));
+}
+
+TEST_F(LoguTest, DottedHierarchy)
+{
+    // Created before the settings below, which reach it through "Dotted.http"
+    logu::logger& client = LOGU_LOGGER("Dotted.http.client");
+    logu::logger& net = LOGU_LOGGER("Dotted");
+
+    std::vector<std::string> lines;
+    net.set_formatter(logu::pattern_formatter("{tag} {message}"))
+        .set_handler([&lines](const logu::record&, const char* str) { lines.emplace_back(str); })
+        .set_severity(logu::severity::warn);
+    EXPECT_FALSE(client.should_output(logu::severity::info));
+    LOGU_INFO_("Dotted.http.client") << "hidden";
+    LOGU_WARN_("Dotted.http.client") << "shown";
+    ASSERT_EQ(1, lines.size());
+    EXPECT_EQ("Dotted.http.client shown", lines[0]);
+
+    // A level on an intermediate logger applies to its subtree only
+    LOGU_LOGGER("Dotted.http").set_severity(logu::severity::debug);
+    EXPECT_TRUE(client.should_output(logu::severity::debug));
+    EXPECT_FALSE(net.should_output(logu::severity::info));
+    EXPECT_FALSE(LOGU_LOGGER("Dotted.db").should_output(logu::severity::info));
+    EXPECT_TRUE(LOGU_LOGGER("Dottedx").should_output(logu::severity::info)); // Not under "Dotted"
+
+    // Own handlers stop the inheritance of handlers only
+    std::vector<std::string> client_lines;
+    client.set_handler([&client_lines](const logu::record&, const char* str) { client_lines.emplace_back(str); });
+    LOGU_INFO_("Dotted.http.client") << "own";
+    EXPECT_EQ(1, lines.size());
+    ASSERT_EQ(1, client_lines.size());
+    EXPECT_EQ("Dotted.http.client own", client_lines[0]);
+
+    net.set_handler(std::cout).set_severity(logu::severity::debug);
+    client.set_handler(std::cout);
+}
+
+TEST_F(LoguTest, Registry)
+{
+    EXPECT_EQ(LOGU_HASH(""), logu::internal::murmur3::murmur3_runtime("", 0));
+    EXPECT_EQ(LOGU_HASH("Registry"), logu::internal::murmur3::murmur3_runtime("Registry", 8));
+    EXPECT_EQ(LOGU_HASH("Registry.x"), logu::internal::murmur3::murmur3_runtime("Registry.x", 10));
+
+    // Threads looking up and creating the same runtime tag names get the same loggers
+    constexpr int thread_count = 4;
+    constexpr int name_count = 200;
+    std::vector<std::vector<logu::logger*>> found(thread_count, std::vector<logu::logger*>(name_count));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([t, &found]() {
+            for (int i = 0; i < name_count; ++i) {
+                const std::string name = "Registry" + std::to_string(i);
+                found[t][i] = &LOGU_LOGGER(name.c_str());
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    for (int i = 0; i < name_count; ++i) {
+        const std::string name = "Registry" + std::to_string(i);
+        EXPECT_EQ(name, found[0][i]->tagname());
+        for (int t = 1; t < thread_count; ++t) {
+            EXPECT_EQ(found[0][i], found[t][i]);
+        }
+    }
+    EXPECT_NE(&LOGU_LOGGER("Registry0"), &LOGU_DEFAULT_LOGGER());
+    EXPECT_EQ(&LOGU_LOGGER(""), &LOGU_DEFAULT_LOGGER());
+}
+
+TEST_F(LoguTest, RateLimit)
+{
+    constexpr auto name = "RateLimit";
+    std::vector<std::string> lines;
+    std::vector<uint64_t> suppressed;
+    LOGU_LOGGER(name)
+        .set_severity(logu::severity::debug)
+        .set_formatter(logu::pattern_formatter("{message}"))
+        .set_handler(std::function<void(const logu::record&, const char*)>([&](const logu::record& record, const char* str) {
+            lines.push_back(str);
+            suppressed.push_back(record.suppressed());
+        }));
+
+    int evaluated = 0;
+    for (int i = 0; i < 10; ++i) {
+        LOGU_INFO_EVERY_N_(name, 4) << i << (++evaluated, "");
+    }
+    ASSERT_EQ(3, lines.size());
+    EXPECT_EQ("0", lines[0]);
+    EXPECT_EQ("4 (3 suppressed)", lines[1]);
+    EXPECT_EQ("8 (3 suppressed)", lines[2]);
+    EXPECT_EQ(3, evaluated);
+    EXPECT_EQ(3u, suppressed[2]);
+
+    lines.clear();
+    for (int i = 0; i < 10; ++i) {
+        LOGU_WARN_FIRST_N_(name, 2) << i;
+    }
+    EXPECT_EQ((std::vector<std::string> { "0", "1" }), lines);
+
+    lines.clear();
+    for (int i = 0; i < 5; ++i) {
+        LOGU_ERROR_EVERY_MS_(name, 60 * 1000) << i;
+    }
+    EXPECT_EQ((std::vector<std::string> { "0" }), lines);
+
+    lines.clear();
+    for (int i = 0; i < 1000; ++i) {
+        LOGU_DEBUG_SAMPLED_(name, 0.0) << i;
+        LOGU_DEBUG_SAMPLED_(name, 1.0) << i;
+    }
+    EXPECT_EQ(1000, lines.size());
+
+    // Disabled severities do not count
+    lines.clear();
+    LOGU_LOGGER(name).set_severity(logu::severity::warn);
+    for (int i = 0; i < 6; ++i) {
+        if (i == 3) {
+            LOGU_LOGGER(name).set_severity(logu::severity::debug);
+        }
+        LOGU_INFO_EVERY_N_(name, 2) << i;
+    }
+    EXPECT_EQ((std::vector<std::string> { "3", "5 (1 suppressed)" }), lines);
+}
+
+TEST_F(LoguTest, RepeatSuppression)
+{
+    constexpr auto name = "RepeatSuppression";
+    std::vector<std::string> lines;
+    LOGU_LOGGER(name)
+        .set_severity(logu::severity::debug)
+        .set_formatter(logu::pattern_formatter("{line} {message}"))
+        .set_handler(std::function<void(const char*)>([&](const char* str) { lines.push_back(str); }))
+        .set_repeat_suppression(std::chrono::minutes(1));
+
+    const auto line_of = [](const std::string& str) { return str.substr(0, str.find(' ')); };
+    for (int i = 0; i < 5; ++i) {
+        LOGU_INFO_(name) << "same";
+    }
+    ASSERT_EQ(1, lines.size());
+    LOGU_INFO_(name) << "other";
+    ASSERT_EQ(3, lines.size());
+    EXPECT_EQ(line_of(lines[0]) + " same", lines[0]);
+    EXPECT_EQ(line_of(lines[0]) + " last message repeated 4 times", lines[1]);
+    EXPECT_NE(line_of(lines[0]), line_of(lines[2]));
+
+    // Same message from another call site is not a repeat
+    lines.clear();
+    LOGU_INFO_(name) << "same";
+    LOGU_INFO_(name) << "same";
+    EXPECT_EQ(2, lines.size());
+
+    // Held back records are reported on flush
+    lines.clear();
+    for (int i = 0; i < 3; ++i) {
+        LOGU_INFO_(name) << "flushed";
+    }
+    LOGU_LOGGER(name).flush();
+    ASSERT_EQ(2, lines.size());
+    EXPECT_EQ(line_of(lines[0]) + " last message repeated 2 times", lines[1]);
+
+    // Records made from fields are compared by content, as their strings may be gone when the report is made
+    lines.clear();
+    for (int i = 0; i < 3; ++i) {
+        const std::string file = "file.cpp";
+        LOGU_LOGGER(name) += logu::record(logu::severity::info, name, file.c_str(), "func", 9) << "fields";
+    }
+    LOGU_LOGGER(name).flush();
+    ASSERT_EQ(2, lines.size());
+    EXPECT_EQ("9 last message repeated 2 times", lines[1]);
+
+    // Zero window disables it
+    lines.clear();
+    LOGU_LOGGER(name).set_repeat_suppression(std::chrono::milliseconds(0));
+    for (int i = 0; i < 3; ++i) {
+        LOGU_INFO_(name) << "same";
+    }
+    EXPECT_EQ(3, lines.size());
+
+    // And when the logger is destroyed
+    lines.clear();
+    {
+        logu::logger local("RepeatSuppressionLocal");
+        local.set_formatter(logu::pattern_formatter("{message}"))
+            .set_handler(std::function<void(const char*)>([&](const char* str) { lines.push_back(str); }))
+            .set_repeat_suppression(std::chrono::minutes(1));
+        for (int i = 0; i < 3; ++i) {
+            local += std::move(logu::record(logu::severity::info, "", "test.cpp", "", 1) << "same");
+        }
+        EXPECT_EQ(1, lines.size());
+    }
+    EXPECT_EQ((std::vector<std::string> { "same", "last message repeated 2 times" }), lines);
+}
+
+TEST_F(LoguTest, CallSiteRegistry)
+{
+    constexpr auto name = "CallSiteRegistry";
+    std::vector<std::string> lines;
+    LOGU_LOGGER(name)
+        .set_severity(logu::severity::warn)
+        .set_formatter(logu::pattern_formatter("{message}"))
+        .set_handler(std::function<void(const char*)>([&](const char* str) { lines.push_back(str); }));
+
+    const auto log = []() {
+        LOGU_DEBUG_(name) << "debug";
+        LOGU_WARN_(name) << "warn";
+    };
+    log();
+    EXPECT_EQ((std::vector<std::string> { "warn" }), lines);
+
+    // Both call sites are registered with their location
+    logu::call_site* debug_site = nullptr;
+    logu::call_site* warn_site = nullptr;
+    logu::call_site::for_each([&](logu::call_site& site) {
+        if (std::string(site.tagname()) == name) {
+            (site.severity() == logu::severity::debug ? debug_site : warn_site) = &site;
+        }
+    });
+    ASSERT_NE(nullptr, debug_site);
+    ASSERT_NE(nullptr, warn_site);
+    EXPECT_STREQ("test.cpp", debug_site->file());
+    EXPECT_EQ(debug_site->line() + 1, warn_site->line());
+    EXPECT_EQ(&LOGU_LOGGER(name), &debug_site->logger());
+
+    // One statement can be turned on or off without changing the logger
+    lines.clear();
+    debug_site->set_state(logu::call_site::state::enabled);
+    warn_site->set_state(logu::call_site::state::disabled);
+    log();
+    EXPECT_EQ((std::vector<std::string> { "debug" }), lines);
+
+    lines.clear();
+    debug_site->set_state(logu::call_site::state::inherit);
+    warn_site->set_state(logu::call_site::state::inherit);
+    log();
+    EXPECT_EQ((std::vector<std::string> { "warn" }), lines);
+
+    // Records made without a call site keep their location inline, also when moved
+    logu::record own(logu::severity::info, name, "own.cpp", "func", 7);
+    const logu::record moved(std::move(own));
+    EXPECT_STREQ("own.cpp", moved.file());
+    EXPECT_EQ(7u, moved.line());
+    const logu::record by_site(*warn_site);
+    EXPECT_EQ(warn_site, &by_site.location());
+}
+
+TEST_F(LoguTest, Stats)
+{
+    constexpr auto name = "Stats";
+    size_t text_bytes = 0;
+    LOGU_LOGGER(name)
+        .set_severity(logu::severity::info)
+        .set_formatter(logu::pattern_formatter("{message}"))
+        .set_handler(std::function<void(const char*)>([&](const char* str) { text_bytes += std::strlen(str); }),
+            std::function<void(const logu::record&)>([](const logu::record&) {}));
+
+    // Nothing is counted until enabled
+    LOGU_INFO_(name) << "before";
+    EXPECT_EQ(0u, LOGU_LOGGER(name).stats().accepted);
+
+    LOGU_LOGGER(name).set_stats(true);
+    text_bytes = 0;
+    for (int i = 0; i < 3; ++i) {
+        LOGU_INFO_(name) << "message";
+        LOGU_DEBUG_(name) << "filtered";
+    }
+    auto stats = LOGU_LOGGER(name).stats();
+    EXPECT_EQ(3u, stats.accepted);
+    EXPECT_EQ(3u, stats.filtered);
+    EXPECT_EQ(3 * std::strlen("message"), stats.bytes_formatted);
+    ASSERT_EQ(2, stats.handlers.size());
+    EXPECT_EQ(text_bytes, stats.handlers[0].bytes);
+    EXPECT_EQ(0u, stats.handlers[1].bytes);
+
+    LOGU_LOGGER(name).reset_stats().set_stats(false);
+    LOGU_INFO_(name) << "after";
+    stats = LOGU_LOGGER(name).stats();
+    EXPECT_EQ(0u, stats.accepted);
+    EXPECT_EQ(0u, stats.bytes_formatted);
+
+    // A child created while the parent counts does not count until enabled on itself
+    LOGU_LOGGER(name).set_stats(true);
+    LOGU_INFO_("Stats.Child") << "child";
+    EXPECT_EQ(0u, LOGU_LOGGER("Stats.Child").stats().accepted);
+    LOGU_LOGGER(name).set_stats(false);
+}
+
+TEST_F(LoguTest, KeyValue)
+{
+    constexpr auto name = "KeyValue";
+    std::vector<std::string> lines;
+    LOGU_LOGGER(name)
+        .set_severity(logu::severity::debug)
+        .set_formatter(logu::pattern_formatter("{message}"))
+        .set_handler(std::function<void(const char*)>([&](const char* str) { lines.push_back(str); }));
+
+    LOGU_INFO_(name).kv("user", 42).kv(std::string("ok"), true) << "done";
+    ASSERT_EQ(1, lines.size());
+    EXPECT_EQ("done user=42 ok=true", lines[0]);
+
+    // Fields are kept typed in the record
+    std::vector<logu::field::type> types;
+    auto record = logu::record(logu::severity::info, "", "", "", 0).kv("i", -1).kv("u", 2u).kv("d", 0.1).kv("s", std::string("x")).kv("c", 'c');
+    record.for_each_field([&types](const logu::field& f) { types.push_back(f.value_type); });
+    EXPECT_EQ((std::vector<logu::field::type> { logu::field::type::signed_integer, logu::field::type::unsigned_integer,
+                  logu::field::type::floating, logu::field::type::string, logu::field::type::string }),
+        types);
+
+    // A record not made by the macros keeps its location across a move, also once the fields leave the inline storage
+    auto moved = logu::record(logu::severity::warn, "Tag", "file.cpp", "func", 7).kv("long", std::string(200, 'x'));
+    EXPECT_EQ(logu::severity::warn, moved.severity());
+    EXPECT_STREQ("Tag", moved.tagname());
+    EXPECT_STREQ("file.cpp", moved.file());
+    EXPECT_EQ(7, moved.line());
+    std::string value;
+    moved.for_each_field([&value](const logu::field& f) { value.assign(f.str.data(), f.str.size()); });
+    EXPECT_EQ(std::string(200, 'x'), value);
+
+    // JSON Lines
+    logu::json_formatter json;
+    lines.clear();
+    LOGU_LOGGER(name).set_formatter(json);
+    LOGU_WARN_(name).kv("latency_us", 1.5).kv("path", "/a\"b\\\n\x01").kv("nan", std::nan("")) << "line1\nline2";
+    ASSERT_EQ(1, lines.size());
+    EXPECT_TRUE(std::regex_match(lines[0],
+        std::regex("\\{\"time\":\"\\d{4}-\\d{2}-\\d{2} \\d{2}:\\d{2}:\\d{2}\\.\\d{6}\",\"severity\":\"WARN\",\"tid\":\\d+,"
+                   "(\"threadname\":\"[^\"]*\",)?\"tag\":\"KeyValue\",\"file\":\"test.cpp\",\"line\":\\d+,"
+                   "\"message\":\"line1\\\\nline2\",\"latency_us\":1.5,\"path\":\"/a\\\\\"b\\\\\\\\\\\\n\\\\u0001\",\"nan\":null\\}")))
+        << lines[0];
+
+    const auto formatted = json.format(std::move(logu::record(logu::severity::none, "", "", "", 0).kv("big", 0.1) << "x"));
+    EXPECT_NE(std::string::npos, formatted.find("\"severity\":\"-----\""));
+    EXPECT_NE(std::string::npos, formatted.find("\"big\":0.1}"));
+
+    // The decimal point does not depend on LC_NUMERIC
+    for (const char* name_locale : { "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8" }) {
+        if (std::setlocale(LC_NUMERIC, name_locale) != nullptr) {
+            const auto localized = json.format(std::move(logu::record(logu::severity::none, "", "", "", 0).kv("d", 1.5).kv("e", 1e-300) << "x"));
+            std::setlocale(LC_NUMERIC, "C");
+            EXPECT_NE(std::string::npos, localized.find("\"d\":1.5,\"e\":1e-300}")) << name_locale << ": " << localized;
+            break;
+        }
+    }
+}
+
+struct counting_formatter : public logu::formatter_base {
+    static int count;
+    std::string format(const logu::record& record) override
+    {
+        ++count;
+        return "counted " + record.message();
+    }
+};
+int counting_formatter::count = 0;
+
+TEST_F(LoguTest, PerHandler)
+{
+    constexpr auto name = "PerHandler";
+    std::vector<std::string> all, compact, counted;
+    int records = 0;
+    LOGU_LOGGER(name)
+        .set_severity(logu::severity::debug)
+        .set_formatter(counting_formatter())
+        .set_handler(std::function<void(const logu::record&)>([&](const logu::record&) { ++records; }));
+
+    // Handlers without text do not make the formatter run
+    counting_formatter::count = 0;
+    LOGU_INFO_(name) << "a";
+    EXPECT_EQ(1, records);
+    EXPECT_EQ(0, counting_formatter::count);
+
+    LOGU_LOGGER(name)
+        .add_handler(std::function<void(const char*)>([&](const char* str) { all.push_back(str); }))
+        .add_handler(std::function<void(const char*)>([&](const char* str) { counted.push_back(str); }))
+        .add_handler(std::function<void(const char*)>([&](const char* str) { compact.push_back(str); }),
+            logu::pattern_formatter("{severity}|{message}"), logu::severity::warn);
+
+    LOGU_DEBUG_(name) << "b";
+    LOGU_WARN_(name) << "c";
+    EXPECT_EQ(3, records);
+    EXPECT_EQ((std::vector<std::string> { "counted b", "counted c" }), all);
+    EXPECT_EQ(all, counted);
+    EXPECT_EQ((std::vector<std::string> { "WARN |c" }), compact);
+
+    // The logger formatter ran once per record for the two handlers sharing it
+    EXPECT_EQ(2, counting_formatter::count);
+}
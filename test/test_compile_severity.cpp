@@ -0,0 +1,44 @@
+﻿// LOGU_COMPILE_MIN_SEVERITY_TAGS applies to the whole translation unit, so it is tested apart from test.cpp
+#define LOGU_COMPILE_MIN_SEVERITY_TAGS { "CompileSeverity", logu::severity::warn }
+#include "logu/logu.hpp"
+
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+
+TEST(LoguCompileSeverity, Tags)
+{
+    static_assert(logu::internal::compile_min_severity("CompileSeverity") == logu::severity::warn, "");
+    static_assert(logu::internal::compile_min_severity("") == logu::severity::debug, "");
+
+    // Removed statements do not evaluate their operands
+    int count = 0;
+    LOGU_INTERNAL_STRIPPED << ++count << std::endl;
+    LOGU_INTERNAL_STRIPPED.format("%d", ++count);
+    EXPECT_EQ(0, count);
+
+    // Tags given to LOGU_COMPILE_MIN_SEVERITY_TAGS keep only the severities above the threshold
+    std::string str;
+    LOGU_LOGGER("CompileSeverity").set_severity(logu::severity::debug);
+    testing::internal::CaptureStdout();
+    LOGU_INFO_("CompileSeverity") << ++count;
+    str = testing::internal::GetCapturedStdout();
+    EXPECT_TRUE(str.empty());
+    EXPECT_EQ(0, count);
+
+    testing::internal::CaptureStdout();
+    LOGU_WARN_("CompileSeverity") << ++count;
+    str = testing::internal::GetCapturedStdout();
+    EXPECT_FALSE(str.empty());
+    EXPECT_EQ(1, count);
+
+    // Only the kept statement registered a call site
+    std::vector<logu::severity> severities;
+    logu::call_site::for_each([&severities](logu::call_site& site) {
+        if (std::string(site.tagname()) == "CompileSeverity") {
+            severities.push_back(site.severity());
+        }
+    });
+    EXPECT_EQ(std::vector<logu::severity> { logu::severity::warn }, severities);
+}
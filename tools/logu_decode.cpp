@@ -0,0 +1,48 @@
+﻿#include "logu/logu.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Convert a log written by logu::binary_sink back into text.
+//
+// Usage: logu_decode [-p PATTERN] FILE
+//   -p PATTERN  Format with logu::pattern_formatter instead of the default logu::formatter
+
+int main(int argc, char* argv[])
+{
+    const char* pattern = nullptr;
+    const char* filename = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            pattern = argv[++i];
+        } else {
+            filename = argv[i];
+        }
+    }
+    if (filename == nullptr) {
+        std::fprintf(stderr, "Usage: %s [-p PATTERN] FILE\n", argv[0]);
+        return 2;
+    }
+
+    logu::binary_reader reader(filename);
+    if (!reader.is_valid()) {
+        std::fprintf(stderr, "%s: not a logu binary log\n", filename);
+        return 1;
+    }
+
+    std::unique_ptr<logu::formatter_base> formatter;
+    if (pattern != nullptr) {
+        formatter.reset(new logu::pattern_formatter(pattern));
+    } else {
+        formatter.reset(new logu::formatter());
+    }
+    logu::format_buffer buffer;
+    while (reader.read_next([&](const logu::record& record) {
+        buffer.clear();
+        formatter->format_to(record, buffer);
+        buffer.push_back('\n');
+        std::fwrite(buffer.data(), 1, buffer.size(), stdout);
+    })) { }
+    return 0;
+}